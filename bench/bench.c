@@ -0,0 +1,407 @@
+#include "stddef.h"
+#include "stdint.h"
+#include "stdio.h"
+#include "stdlib.h"
+#include "stdbool.h"
+#include "string.h"
+#include "unistd.h"
+#include "errno.h"
+#include "fcntl.h"
+#include "poll.h"
+#include "pthread.h"
+#include "time.h"
+#include "sys/resource.h"
+#include "sys/wait.h"
+
+#include "interface.h"
+#include "search.h"
+#include "pool.h"
+
+
+// benchmarks of the hot paths of the pager (see make bench)
+//
+// every result is one line of key=value pairs, starting with bench= and the
+// line length distribution it ran on and ending with the peak RSS of the
+// process it ran in (every distribution, and the lists, get a process of
+// their own), so two runs can be compared line by line:
+//
+//   bench=ingest dist=mixed lines=... lines_per_s=... ns_per_line=... peak_rss_kib=...
+//
+// lines starting with # are comments
+
+// the megabytes of lines generated for each distribution, unless given
+// as the first argument
+#define BENCH_DEFAULT_MEGABYTES 32
+// the terminal the frames are drawn for
+#define BENCH_ROWS 50
+#define BENCH_COLS 160
+#define BENCH_FRAMES 2000
+#define BENCH_LIST_ITEMS ((size_t)16 * 1024 * 1024)
+#define BENCH_PUSHALL_ITEMS ((size_t)1024 * 1024)
+#define BENCH_PUSHALL_ROUNDS 16
+// the same lines every run, so results only change with the code
+#define BENCH_SEED 0x9e3779b97f4a7c15
+
+typedef struct {
+  const char *name;
+  size_t min_length, max_length;
+  // the lines are colored with escape sequences
+  bool styled;
+} Distribution;
+
+static const Distribution distributions[] = {
+  { "short", 4, 16, false },
+  { "mixed", 20, 200, false },
+  { "long", 500, 4000, false },
+  { "styled", 20, 200, true },
+};
+
+typedef struct {
+  char *data;
+  size_t size;
+  size_t line_count;
+} Dataset;
+
+static uint64_t random_state;
+
+static uint64_t next_random() {
+  random_state ^= random_state << 13;
+  random_state ^= random_state >> 7;
+  random_state ^= random_state << 17;
+  return random_state;
+}
+
+static double seconds_since(struct timespec start) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec - start.tv_sec) + (now.tv_nsec - start.tv_nsec) / 1e9;
+}
+
+static long peak_rss_kib() {
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_maxrss;
+}
+
+// lines of words with lengths spread evenly over the distribution's
+// range, a quarter of them start with ERROR for the search to find
+static Dataset Dataset_generate(const Distribution *distribution, size_t size) {
+  random_state = BENCH_SEED;
+  Dataset self = { .data = malloc(size + distribution->max_length + 16), .size = 0, .line_count = 0 };
+  while (self.size < size) {
+    size_t length = distribution->min_length
+      + next_random() % (distribution->max_length - distribution->min_length + 1);
+    char *line = self.data + self.size;
+    size_t i = 0;
+    if (distribution->styled) {
+      memcpy(line, "\x1b[31m", 5);
+      line[3] = '1' + next_random() % 6;
+      line += 5;
+      self.size += 5;
+    }
+    if (length >= 5 && next_random() % 4 == 0) {
+      memcpy(line, "ERROR", 5);
+      i = 5;
+    }
+    for (; i < length; i += 1) {
+      uint64_t random = next_random();
+      line[i] = (random % 8 == 0) ? ' ' : 'a' + (random >> 8) % 26;
+    }
+    if (distribution->styled) {
+      memcpy(line + length, "\x1b[0m", 4);
+      length += 4;
+    }
+    line[length] = '\n';
+    self.size += length + 1;
+    self.line_count += 1;
+  }
+  return self;
+}
+
+typedef struct {
+  int fd;
+  const char *data;
+  size_t size;
+} PipeWriter;
+
+static void *PipeWriter_run(void *args) {
+  PipeWriter *self = args;
+  size_t written = 0;
+  while (written < self->size) {
+    ssize_t result = write(self->fd, self->data + written, self->size - written);
+    if (result < 0 && errno == EINTR) { continue; }
+    if (result < 0) {
+      fprintf(stderr, "WARN: failed to write to the benchmark pipe -> %s\n", strerror(errno));
+      break;
+    }
+    written += result;
+  }
+  close(self->fd);
+  return NULL;
+}
+
+// takes the lines of the window as the main loop does until it is indexed,
+// returns the time spent in Window_update and how many times it was called
+static double wait_until_indexed(Window *window, size_t *updates) {
+  double update_seconds = 0;
+  *updates = 0;
+  struct pollfd wake = { .fd = window->wake_fd, .events = POLLIN };
+  while (!window->fully_indexed) {
+    if (poll(&wake, 1, -1) < 0 && errno != EINTR) { break; }
+    Window_acknowledge_wake(window);
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    Window_update(window);
+    update_seconds += seconds_since(start);
+    *updates += 1;
+  }
+  return update_seconds;
+}
+
+// a stream read through a pipe, what the reader of --spawn and of piped
+// input does, and the handoff of its lines to the UI thread
+static void bench_ingest(Pool *pool, const Distribution *distribution, Dataset *dataset) {
+  int pipe_fds[2];
+  if (pipe(pipe_fds) < 0) {
+    fprintf(stderr, "WARN: failed to create the benchmark pipe -> %s\n", strerror(errno));
+    return;
+  }
+  Window window = Window_new(pipe_fds[0], NULL, 0, pool);
+  PipeWriter writer = { .fd = pipe_fds[1], .data = dataset->data, .size = dataset->size };
+
+  struct timespec start;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  pthread_t writer_thread;
+  pthread_create(&writer_thread, NULL, PipeWriter_run, &writer);
+  Window_spawn_reader(&window);
+  size_t updates = 0;
+  double update_seconds = wait_until_indexed(&window, &updates);
+  double seconds = seconds_since(start);
+  pthread_join(writer_thread, NULL);
+  pthread_join(window.reader_thread, NULL);
+
+  size_t lines = Window_line_count(&window);
+  printf("bench=ingest dist=%s lines=%zu bytes=%zu seconds=%.6f lines_per_s=%.0f ns_per_line=%.2f mb_per_s=%.1f peak_rss_kib=%ld\n",
+    distribution->name, lines, dataset->size, seconds, lines / seconds, seconds * 1e9 / lines,
+    dataset->size / seconds / 1e6, peak_rss_kib()
+  );
+  printf("bench=update dist=%s updates=%zu lines_per_update=%.1f ns_per_update=%.1f ns_per_line=%.3f peak_rss_kib=%ld\n",
+    distribution->name, updates, (double)lines / updates, update_seconds * 1e9 / updates,
+    update_seconds * 1e9 / lines, peak_rss_kib()
+  );
+  close(pipe_fds[0]);
+  Window_free(&window);
+}
+
+// a regular file mapped and indexed on the pool, the window is left
+// open for the benchmarks that need lines to look at
+static bool bench_index(Pool *pool, const Distribution *distribution, Dataset *dataset, Window *window, int *file_fd) {
+  char path[] = "/tmp/pager_bench_XXXXXX";
+  int fd = mkstemp(path);
+  if (fd < 0) {
+    fprintf(stderr, "WARN: failed to create the benchmark file -> %s\n", strerror(errno));
+    return false;
+  }
+  // NOTE the mapping keeps the file alive
+  unlink(path);
+  PipeWriter writer = { .fd = dup(fd), .data = dataset->data, .size = dataset->size };
+  PipeWriter_run(&writer);
+
+  struct timespec start;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  *window = Window_new(fd, NULL, 0, pool);
+  Window_spawn_reader(window);
+  size_t updates = 0;
+  wait_until_indexed(window, &updates);
+  double seconds = seconds_since(start);
+
+  size_t lines = Window_line_count(window);
+  printf("bench=index dist=%s lines=%zu bytes=%zu seconds=%.6f lines_per_s=%.0f ns_per_line=%.2f mb_per_s=%.1f peak_rss_kib=%ld\n",
+    distribution->name, lines, dataset->size, seconds, lines / seconds, seconds * 1e9 / lines,
+    dataset->size / seconds / 1e6, peak_rss_kib()
+  );
+  *file_fd = fd;
+  return true;
+}
+
+typedef enum {
+  // a page down per frame, every row is new
+  RENDER_PAGE,
+  // a line down per frame, the terminal scrolls the rest
+  RENDER_LINE,
+  // a page down per frame with long lines wrapped
+  RENDER_WRAP,
+} RenderMode;
+
+static const char *render_mode_names[] = { "page", "line", "wrap" };
+
+// composes frames of the window into the canvas and the output buffer,
+// which is written to /dev/null instead of the terminal
+static void bench_render(Window *window, const Distribution *distribution, RenderMode mode) {
+  window->window_start = 0;
+  window->column_start = 0;
+  Window_set_wrap(window, mode == RENDER_WRAP);
+  Screen screen = {
+    // NOTE the screen borrows the window, the list is never grown or freed
+    .windows = { .items = window, .item_count = 1, .buffer_size = 1 },
+    .focus = 0,
+    .output = OutputBuffer_new(64 * 1024),
+    .rows = BENCH_ROWS,
+    .cols = BENCH_COLS,
+  };
+
+  fflush(stdout);
+  int terminal_fd = dup(STDOUT_FILENO);
+  int null_fd = open("/dev/null", O_WRONLY);
+  dup2(null_fd, STDOUT_FILENO);
+
+  // the first frame erases the terminal, only the ones after are counted
+  Screen_render(&screen);
+  screen.frame_count = 0;
+  screen.total_frame_bytes = 0;
+  screen.total_frame_syscalls = 0;
+  size_t height = screen.frames[0].height;
+  struct timespec start;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (size_t i = 0; i < BENCH_FRAMES; i += 1) {
+    size_t before = window->window_start, row_before = window->row_start;
+    Window_move_down(window, (mode == RENDER_LINE) ? 1 : height, height);
+    if (window->window_start == before && window->row_start == row_before) {
+      window->window_start = 0;
+      window->row_start = 0;
+    }
+    Screen_mark_dirty(&screen, window);
+    Screen_render(&screen);
+  }
+  double seconds = seconds_since(start);
+
+  dup2(terminal_fd, STDOUT_FILENO);
+  close(terminal_fd);
+  close(null_fd);
+
+  printf("bench=render dist=%s mode=%s frames=%zu seconds=%.6f ns_per_frame=%.0f bytes_per_frame=%.1f syscalls_per_frame=%.2f peak_rss_kib=%ld\n",
+    distribution->name, render_mode_names[mode], screen.frame_count, seconds, seconds * 1e9 / screen.frame_count,
+    (double)screen.total_frame_bytes / screen.frame_count,
+    (double)screen.total_frame_syscalls / screen.frame_count, peak_rss_kib()
+  );
+  Window_set_wrap(window, false);
+  free(screen.frames);
+  free(screen.layout);
+  Canvas_free(&screen.front);
+  Canvas_free(&screen.back);
+  OutputBuffer_free(&screen.output);
+}
+
+// counts the matches of pattern in every line of the window
+static void bench_search(Pool *pool, Window *window, const Distribution *distribution, const char *name, const char *pattern) {
+  Search *search = Search_new(pool, window, 1);
+  struct timespec start;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  Search_start(search, window, pattern, strlen(pattern), SEARCH_REQUEST_COUNT, SEARCH_FORWARD, 0, 0);
+  struct pollfd wake = { .fd = search->wake_fd, .events = POLLIN };
+  while (true) {
+    if (poll(&wake, 1, -1) < 0 && errno != EINTR) { break; }
+    int64_t result = Search_poll(search);
+    if (result != SEARCH_PENDING && !search->running) { break; }
+  }
+  double seconds = seconds_since(start);
+
+  size_t lines = Window_line_count(window);
+  printf("bench=search dist=%s pattern=%s lines=%zu matches=%zu seconds=%.6f lines_per_s=%.0f ns_per_line=%.2f peak_rss_kib=%ld\n",
+    distribution->name, name, lines, Search_window_match_count(search, window), seconds,
+    lines / seconds, seconds * 1e9 / lines, peak_rss_kib()
+  );
+  Search_free(search);
+}
+
+// the growth of the lists every index is built on
+static void bench_list() {
+  struct timespec start;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  List_size_t list = List_size_t_new(1);
+  for (size_t i = 0; i < BENCH_LIST_ITEMS; i += 1) { List_size_t_push(&list, i); }
+  double seconds = seconds_since(start);
+  printf("bench=list_push items=%zu seconds=%.6f items_per_s=%.0f ns_per_item=%.3f peak_rss_kib=%ld\n",
+    list.item_count, seconds, list.item_count / seconds, seconds * 1e9 / list.item_count, peak_rss_kib()
+  );
+  List_size_t_free(&list);
+
+  List_size_t chunk = List_size_t_new(BENCH_PUSHALL_ITEMS);
+  for (size_t i = 0; i < BENCH_PUSHALL_ITEMS; i += 1) { List_size_t_push(&chunk, i); }
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  List_size_t all = List_size_t_new(1);
+  for (size_t i = 0; i < BENCH_PUSHALL_ROUNDS; i += 1) { List_size_t_pushall(&all, &chunk); }
+  seconds = seconds_since(start);
+  printf("bench=list_pushall items=%zu seconds=%.6f items_per_s=%.0f ns_per_item=%.3f peak_rss_kib=%ld\n",
+    all.item_count, seconds, all.item_count / seconds, seconds * 1e9 / all.item_count, peak_rss_kib()
+  );
+  List_size_t_free(&all);
+  List_size_t_free(&chunk);
+}
+
+// every benchmark of lines on the lines of one distribution
+static void bench_distribution(const Distribution *distribution, size_t megabytes) {
+  Pool *pool = Pool_new(0);
+  Dataset dataset = Dataset_generate(distribution, megabytes << 20);
+  bench_ingest(pool, distribution, &dataset);
+
+  Window window;
+  int file_fd = -1;
+  if (bench_index(pool, distribution, &dataset, &window, &file_fd)) {
+    bench_render(&window, distribution, RENDER_PAGE);
+    bench_render(&window, distribution, RENDER_LINE);
+    bench_render(&window, distribution, RENDER_WRAP);
+    bench_search(pool, &window, distribution, "literal", "ERROR");
+    bench_search(pool, &window, distribution, "regex", "q[a-c]+z|x[0-9]");
+    // NOTE the file reader waits to be told to follow once it is done, it
+    // is stopped the way main stops it
+    pthread_cancel(window.reader_thread);
+    pthread_join(window.reader_thread, NULL);
+    Window_free(&window);
+    close(file_fd);
+  }
+  free(dataset.data);
+  Pool_free(pool);
+}
+
+int main(int argc, char **argv) {
+  size_t megabytes = BENCH_DEFAULT_MEGABYTES;
+  if (argc > 1) {
+    char *end = NULL;
+    megabytes = strtoull(argv[1], &end, 10);
+    if (*end != '\0' || megabytes == 0) {
+      fprintf(stderr, "usage: %s [megabytes of lines per distribution]\n", argv[0]);
+      return -1;
+    }
+  }
+
+  Pool *pool = Pool_new(0);
+  printf("# pager bench megabytes=%zu workers=%zu rows=%i cols=%i\n",
+    megabytes, pool->worker_count, BENCH_ROWS, BENCH_COLS
+  );
+  Pool_free(pool);
+
+  // NOTE the peak RSS getrusage reports never goes down, so every
+  // distribution runs in a child of its own, the lists in the last one
+  size_t distribution_count = sizeof(distributions) / sizeof(distributions[0]);
+  for (size_t i = 0; i <= distribution_count; i += 1) {
+    fflush(stdout);
+    pid_t child = fork();
+    if (child < 0) {
+      fprintf(stderr, "WARN: failed to fork a benchmark process -> %s\n", strerror(errno));
+      return -1;
+    }
+    if (child == 0) {
+      if (i == distribution_count) { bench_list(); }
+      else { bench_distribution(&distributions[i], megabytes); }
+      fflush(stdout);
+      _exit(0);
+    }
+    int status = 0;
+    waitpid(child, &status, 0);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+      fprintf(stderr, "WARN: benchmark process %zu did not finish\n", i);
+    }
+  }
+  return 0;
+}
@@ -3,8 +3,11 @@
 #include "stddef.h"
 #include "stdlib.h"
 
+#include "stdbool.h"
+
 #include "list.h"
 #include "linked_list.h"
+#include "spsc_list.h"
 
 #ifndef PTYPES_H
 #define PTYPES_H
@@ -0,0 +1,109 @@
+
+#include "stdatomic.h"
+
+#ifndef PTYPES_SPSC_LIST_H
+#define PTYPES_SPSC_LIST_H
+
+// items live in fixed size segments that are never moved, so the consumer
+// can keep reading published items while the producer appends more
+#define SPSC_SEGMENT_BITS 16
+#define SPSC_SEGMENT_SIZE ((size_t)1 << SPSC_SEGMENT_BITS)
+#define SPSC_MAX_SEGMENTS ((size_t)1 << 16)
+
+// an append only list shared by exactly one producer thread and one
+// consumer thread without any locking
+//
+// the producer pushes items (which are invisible to the consumer) and then
+// publishes them as one batch, the consumer takes every published batch at
+// once with a single atomic load
+//
+// + no mutex and no copying on either side
+// + published items stay where they are for the life of the list
+// - items can not be removed
+#define declare_SpscList_struct(ItemT) \
+typedef struct { \
+  ItemT **segments; \
+  size_t pushed_count; \
+  _Atomic size_t published_count; \
+} SpscList_ ## ItemT;
+
+#define declare_SpscList_new(ItemT) \
+SpscList_ ## ItemT SpscList_ ## ItemT ## _new();
+
+#define define_SpscList_new(ItemT) \
+SpscList_ ## ItemT SpscList_ ## ItemT ## _new() { \
+  SpscList_ ## ItemT self = { \
+    .segments = calloc(SPSC_MAX_SEGMENTS, sizeof(ItemT *)), \
+    .pushed_count = 0, \
+  }; \
+  atomic_init(&self.published_count, 0); \
+  return self; \
+}
+
+// producer only, returns false if the list is full
+#define declare_SpscList_push(ItemT) \
+bool SpscList_ ## ItemT ## _push(SpscList_ ## ItemT *self, ItemT item);
+
+#define define_SpscList_push(ItemT) \
+bool SpscList_ ## ItemT ## _push(SpscList_ ## ItemT *self, ItemT item) { \
+  size_t segment = self->pushed_count >> SPSC_SEGMENT_BITS; \
+  if (segment == SPSC_MAX_SEGMENTS) { return false; } \
+  if (self->segments[segment] == NULL) { \
+    self->segments[segment] = malloc(SPSC_SEGMENT_SIZE * sizeof(ItemT)); \
+  } \
+  self->segments[segment][self->pushed_count & (SPSC_SEGMENT_SIZE - 1)] = item; \
+  self->pushed_count += 1; \
+  return true; \
+}
+
+// producer only, makes every pushed item visible to the consumer
+#define declare_SpscList_publish(ItemT) \
+void SpscList_ ## ItemT ## _publish(SpscList_ ## ItemT *self);
+
+#define define_SpscList_publish(ItemT) \
+void SpscList_ ## ItemT ## _publish(SpscList_ ## ItemT *self) { \
+  atomic_store_explicit(&self->published_count, self->pushed_count, memory_order_release); \
+}
+
+// consumer only, returns the number of items that are safe to read
+#define declare_SpscList_take(ItemT) \
+size_t SpscList_ ## ItemT ## _take(SpscList_ ## ItemT *self);
+
+#define define_SpscList_take(ItemT) \
+size_t SpscList_ ## ItemT ## _take(SpscList_ ## ItemT *self) { \
+  return atomic_load_explicit(&self->published_count, memory_order_acquire); \
+}
+
+// NOTE index must be less than a count returned by take (or pushed_count
+// on the producer side), it is not bounds checked
+#define SpscList_at(list, index) \
+((list).segments[(index) >> SPSC_SEGMENT_BITS][(index) & (SPSC_SEGMENT_SIZE - 1)])
+
+#define declare_SpscList_free(ItemT) \
+void SpscList_ ## ItemT ## _free(SpscList_ ## ItemT *self);
+
+#define define_SpscList_free(ItemT) \
+void SpscList_ ## ItemT ## _free(SpscList_ ## ItemT *self) { \
+  for (size_t i = 0; i < SPSC_MAX_SEGMENTS && self->segments[i] != NULL; i += 1) { \
+    free(self->segments[i]); \
+  } \
+  free(self->segments); \
+}
+
+
+#define declare_SpscList(ItemT) \
+declare_SpscList_struct(ItemT) \
+declare_SpscList_new(ItemT) \
+declare_SpscList_push(ItemT) \
+declare_SpscList_publish(ItemT) \
+declare_SpscList_take(ItemT) \
+declare_SpscList_free(ItemT)
+
+#define define_SpscList(ItemT) \
+define_SpscList_new(ItemT) \
+define_SpscList_push(ItemT) \
+define_SpscList_publish(ItemT) \
+define_SpscList_take(ItemT) \
+define_SpscList_free(ItemT)
+
+#endif
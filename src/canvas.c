@@ -0,0 +1,244 @@
+
+#include "stdint.h"
+#include "stdio.h"
+#include "stdlib.h"
+#include "string.h"
+#include "stdbool.h"
+
+#include "canvas.h"
+#include "width.h"
+
+
+#define GLYPH_SPACE ((uint32_t)' ')
+// the right half of a wide character, the terminal draws it along with the left
+#define GLYPH_WIDE_TAIL ((uint32_t)0)
+// reprinting a handful of unchanged cells is cheaper than moving the cursor past them
+#define MAX_UNCHANGED_GAP 8
+
+
+void Canvas_resize(Canvas *self, uint16_t rows, uint16_t cols) {
+  if (self->rows != rows || self->cols != cols) {
+    self->rows = rows;
+    self->cols = cols;
+    self->cells = realloc(self->cells, (size_t)rows * cols * sizeof(Cell));
+  }
+  Canvas_clear(self);
+}
+
+void Canvas_clear(Canvas *self) {
+  size_t cell_count = (size_t)self->rows * self->cols;
+  for (size_t i = 0; i < cell_count; i += 1) {
+    self->cells[i] = (Cell){ .glyph = GLYPH_SPACE, .style = STYLE_DEFAULT };
+  }
+}
+
+Cell *Canvas_row(Canvas *self, uint16_t row) {
+  return self->cells + (size_t)row * self->cols;
+}
+
+void Canvas_fill(Canvas *self, uint16_t row, uint16_t col, uint16_t count, char glyph, CellStyle style) {
+  if (row >= self->rows) { return; }
+  Cell *cells = Canvas_row(self, row);
+  for (uint16_t i = col; i < col + count && i < self->cols; i += 1) {
+    cells[i] = (Cell){ .glyph = (uint8_t)glyph, .style = style };
+  }
+}
+
+uint16_t Canvas_put_text(
+  Canvas *self, uint16_t row, uint16_t col, uint16_t end_col,
+  const char *text, size_t length, CellStyle style
+) {
+  return Canvas_put_text_at(self, row, col, end_col, text, length, style, 0);
+}
+
+uint16_t Canvas_put_text_at(
+  Canvas *self, uint16_t row, uint16_t col, uint16_t end_col,
+  const char *text, size_t length, CellStyle style, size_t text_column
+) {
+  if (row >= self->rows) { return col; }
+  if (end_col > self->cols) { end_col = self->cols; }
+  Cell *cells = Canvas_row(self, row);
+  uint16_t start_col = col;
+
+  size_t i = 0;
+  while (i < length && col < end_col) {
+    uint32_t codepoint, columns;
+    size_t sequence_length = text_next(text + i, length - i, text_column + (col - start_col), &codepoint, &columns);
+    if (codepoint == '\t') {
+      for (uint32_t c = 0; c < columns && col < end_col; c += 1) {
+        cells[col] = (Cell){ .glyph = GLYPH_SPACE, .style = style };
+        col += 1;
+      }
+    }
+    else if (codepoint < 0x20 || codepoint == 0x7f) {
+      cells[col] = (Cell){ .glyph = '^', .style = style };
+      col += 1;
+      if (col < end_col) {
+        cells[col] = (Cell){ .glyph = codepoint ^ 0x40, .style = style };
+        col += 1;
+      }
+    }
+    else if (codepoint == CODEPOINT_INVALID) {
+      cells[col] = (Cell){ .glyph = '?', .style = style };
+      col += 1;
+    }
+    else if (columns == 0) {
+      // a combining mark goes into the cell of the character before it
+      // when it fits, otherwise it is left out
+      uint16_t base = (col > start_col && cells[col - 1].glyph == GLYPH_WIDE_TAIL) ? col - 2 : col - 1;
+      if (col > start_col && base >= start_col) {
+        uint32_t glyph = cells[base].glyph;
+        size_t used = (glyph > 0xffffff) ? 4 : (glyph > 0xffff) ? 3 : (glyph > 0xff) ? 2 : 1;
+        if (used + sequence_length <= sizeof(glyph)) {
+          for (size_t b = 0; b < sequence_length; b += 1) {
+            glyph |= (uint32_t)(uint8_t)text[i + b] << (8 * (used + b));
+          }
+          cells[base].glyph = glyph;
+        }
+      }
+    }
+    else if (columns == 2 && col + 1 >= end_col) {
+      // NOTE a wide character cut in half by the border is left blank
+      cells[col] = (Cell){ .glyph = GLYPH_SPACE, .style = style };
+      col += 1;
+    }
+    else {
+      uint32_t glyph = 0;
+      for (size_t b = 0; b < sequence_length; b += 1) {
+        glyph |= (uint32_t)(uint8_t)text[i + b] << (8 * b);
+      }
+      cells[col] = (Cell){ .glyph = glyph, .style = style };
+      col += 1;
+      if (columns == 2) {
+        cells[col] = (Cell){ .glyph = GLYPH_WIDE_TAIL, .style = style };
+        col += 1;
+      }
+    }
+    i += sequence_length;
+  }
+  return col;
+}
+
+static bool CellStyle_equal(CellStyle a, CellStyle b) {
+  return a.flags == b.flags && a.fg == b.fg && a.bg == b.bg;
+}
+
+static bool Cell_equal(Cell a, Cell b) {
+  return a.glyph == b.glyph && CellStyle_equal(a.style, b.style);
+}
+
+static void emit_style(OutputBuffer *out, CellStyle style) {
+  OutputBuffer_push(out, "\x1b[0", 3);
+  if (style.flags & STYLE_BOLD) { OutputBuffer_push(out, ";1", 2); }
+  if (style.flags & STYLE_DIM) { OutputBuffer_push(out, ";2", 2); }
+  if (style.flags & STYLE_ITALIC) { OutputBuffer_push(out, ";3", 2); }
+  if (style.flags & STYLE_UNDERLINE) { OutputBuffer_push(out, ";4", 2); }
+  if (style.flags & STYLE_REVERSE) { OutputBuffer_push(out, ";7", 2); }
+  if (style.flags & STYLE_FG_SET) {
+    OutputBuffer_push(out, ";38;5;", 6);
+    OutputBuffer_push_uint(out, style.fg);
+  }
+  if (style.flags & STYLE_BG_SET) {
+    OutputBuffer_push(out, ";48;5;", 6);
+    OutputBuffer_push_uint(out, style.bg);
+  }
+  OutputBuffer_push_byte(out, 'm');
+}
+
+static void emit_glyph(OutputBuffer *out, uint32_t glyph) {
+  do {
+    OutputBuffer_push_byte(out, glyph & 0xff);
+    glyph >>= 8;
+  } while (glyph != 0);
+}
+
+void Canvas_present(Canvas *next, Canvas *previous, OutputBuffer *out) {
+  if (next->rows != previous->rows || next->cols != previous->cols) {
+    fprintf(stderr, "WARN: presenting canvases of different sizes\n");
+    return;
+  }
+  CellStyle current_style = STYLE_DEFAULT;
+
+  for (uint16_t row = 0; row < next->rows; row += 1) {
+    Cell *next_cells = Canvas_row(next, row);
+    Cell *previous_cells = Canvas_row(previous, row);
+
+    uint16_t col = 0;
+    while (col < next->cols) {
+      if (Cell_equal(next_cells[col], previous_cells[col])) { col += 1; continue; }
+
+      // extend the damaged span over small runs of unchanged cells
+      uint16_t span_end = col + 1;
+      uint16_t scan = span_end;
+      while (scan < next->cols && scan - span_end <= MAX_UNCHANGED_GAP) {
+        if (!Cell_equal(next_cells[scan], previous_cells[scan])) { span_end = scan + 1; }
+        scan += 1;
+      }
+
+      // NOTE a wide character is always written whole, writing over either
+      // half of one on the terminal blanks the other half too
+      if (col > 0 && (next_cells[col].glyph == GLYPH_WIDE_TAIL || previous_cells[col].glyph == GLYPH_WIDE_TAIL)) {
+        col -= 1;
+      }
+      if (
+        span_end < next->cols &&
+        (next_cells[span_end].glyph == GLYPH_WIDE_TAIL || previous_cells[span_end].glyph == GLYPH_WIDE_TAIL)
+      ) {
+        span_end += 1;
+      }
+
+      OutputBuffer_move_cursor(out, row + 1, col + 1);
+      for (uint16_t i = col; i < span_end; i += 1) {
+        if (!CellStyle_equal(current_style, next_cells[i].style)) {
+          current_style = next_cells[i].style;
+          emit_style(out, current_style);
+        }
+        if (next_cells[i].glyph != GLYPH_WIDE_TAIL) { emit_glyph(out, next_cells[i].glyph); }
+        previous_cells[i] = next_cells[i];
+      }
+      col = span_end;
+    }
+  }
+
+  if (current_style.flags != 0) { OutputBuffer_push(out, "\x1b[0m", 4); }
+}
+
+void Canvas_scroll(Canvas *self, OutputBuffer *out, uint16_t top, uint16_t bottom, int32_t amount) {
+  if (bottom >= self->rows || top >= bottom || amount == 0) { return; }
+  uint16_t region_rows = bottom - top + 1;
+  uint16_t distance = (amount < 0) ? -amount : amount;
+  if (distance >= region_rows) { return; }
+
+  OutputBuffer_push(out, "\x1b[", 2);
+  OutputBuffer_push_uint(out, top + 1);
+  OutputBuffer_push_byte(out, ';');
+  OutputBuffer_push_uint(out, bottom + 1);
+  OutputBuffer_push_byte(out, 'r');
+  OutputBuffer_push(out, "\x1b[", 2);
+  OutputBuffer_push_uint(out, distance);
+  OutputBuffer_push_byte(out, (amount > 0) ? 'S' : 'T');
+  // NOTE resetting the region also homes the cursor, every span is positioned anyway
+  OutputBuffer_push(out, "\x1b[r", 3);
+
+  size_t row_bytes = (size_t)self->cols * sizeof(Cell);
+  size_t moved_bytes = (size_t)(region_rows - distance) * row_bytes;
+  uint16_t exposed_start;
+  if (amount > 0) {
+    memmove(Canvas_row(self, top), Canvas_row(self, top + distance), moved_bytes);
+    exposed_start = bottom + 1 - distance;
+  }else {
+    memmove(Canvas_row(self, top + distance), Canvas_row(self, top), moved_bytes);
+    exposed_start = top;
+  }
+  // the terminal fills the exposed rows with blanks in the default style
+  Cell *exposed = Canvas_row(self, exposed_start);
+  for (size_t i = 0; i < (size_t)distance * self->cols; i += 1) {
+    exposed[i] = (Cell){ .glyph = GLYPH_SPACE, .style = STYLE_DEFAULT };
+  }
+}
+
+void Canvas_free(Canvas *self) {
+  free(self->cells);
+  self->cells = NULL;
+  self->rows = self->cols = 0;
+}
@@ -0,0 +1,76 @@
+#include "stdio.h"
+#include "stdint.h"
+#include "stdbool.h"
+#include "stddef.h"
+
+#include "output.h"
+
+#ifndef CANVAS_H
+#define CANVAS_H
+
+typedef enum {
+  STYLE_FG_SET = 1 << 0,
+  STYLE_BG_SET = 1 << 1,
+  STYLE_BOLD = 1 << 2,
+  STYLE_DIM = 1 << 3,
+  STYLE_ITALIC = 1 << 4,
+  STYLE_UNDERLINE = 1 << 5,
+  STYLE_REVERSE = 1 << 6,
+} CellStyleFlags;
+
+// fg and bg are indexes into the 256 color xterm palette and are
+// only meaningful when their STYLE_*_SET flag is set
+typedef struct {
+  uint8_t fg;
+  uint8_t bg;
+  uint8_t flags;
+} CellStyle;
+
+#define STYLE_DEFAULT ((CellStyle){ 0 })
+#define STYLE_BACKGROUND(color) ((CellStyle){ .bg = color, .flags = STYLE_BG_SET })
+
+// a single character cell of the terminal
+typedef struct {
+  // the utf-8 bytes of the glyph packed starting from the low byte, followed
+  // by a combining mark if it fits, 0 in the right cell of a wide character
+  uint32_t glyph;
+  CellStyle style;
+} Cell;
+
+// a grid of cells covering the whole terminal, the Screen keeps the one that is
+// on the terminal and the one being drawn so only their differences get written
+typedef struct {
+  uint16_t rows, cols;
+  Cell *cells;
+} Canvas;
+
+// resizes the canvas and fills it with blank cells (what an erased terminal shows)
+void Canvas_resize(Canvas *self, uint16_t rows, uint16_t cols);
+void Canvas_clear(Canvas *self);
+Cell *Canvas_row(Canvas *self, uint16_t row);
+// NOTE rows and columns are counted from 0, the terminal counts from 1
+void Canvas_fill(Canvas *self, uint16_t row, uint16_t col, uint16_t count, char glyph, CellStyle style);
+// draws text starting at col and stopping before end_col, returns the column after the text
+//
+// tabs are expanded and control characters are shown in caret notation,
+// characters take as many columns as text_next says (see width.h)
+uint16_t Canvas_put_text(
+  Canvas *self, uint16_t row, uint16_t col, uint16_t end_col,
+  const char *text, size_t length, CellStyle style
+);
+// like Canvas_put_text for text that starts at display column text_column of
+// its line (past the part scrolled off to the left), which tabs stop relative to
+uint16_t Canvas_put_text_at(
+  Canvas *self, uint16_t row, uint16_t col, uint16_t end_col,
+  const char *text, size_t length, CellStyle style, size_t text_column
+);
+// has the terminal move rows top through bottom (inclusive) up by amount rows,
+// or down for a negative amount, using a scroll region (DECSTBM) and SU/SD,
+// the canvas is shifted to match so that only the exposed rows differ afterwards
+void Canvas_scroll(Canvas *self, OutputBuffer *out, uint16_t top, uint16_t bottom, int32_t amount);
+// composes the escape sequences for only the cells of next that differ from
+// previous into out, previous is then updated to match what will be on the terminal
+void Canvas_present(Canvas *next, Canvas *previous, OutputBuffer *out);
+void Canvas_free(Canvas *self);
+
+#endif
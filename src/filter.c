@@ -0,0 +1,162 @@
+#include "stdint.h"
+#include "stdio.h"
+#include "stdlib.h"
+#include "string.h"
+#include "unistd.h"
+#include "errno.h"
+#include "pthread.h"
+#include "sys/eventfd.h"
+
+#include "filter.h"
+
+
+// how many lines are scanned between checks for stopping
+#define FILTER_CHECK_INTERVAL 4096
+
+static void Filter_scan_chunk(void *context, size_t task) {
+  Filter *self = context;
+  FilterChunk *chunk = &self->chunks[task];
+  LinePin pin = LINE_PIN_NONE;
+  chunk->matches.item_count = 0;
+  for (size_t line = chunk->first_line; line < chunk->end_line; line += 1) {
+    if ((line - chunk->first_line) % FILTER_CHECK_INTERVAL == 0
+      && atomic_load_explicit(&self->stop, memory_order_relaxed)
+    ) { break; }
+    if (Search_line_matches(chunk->matcher, Window_get_line(self->window, line, &pin))) {
+      List_size_t_push(&chunk->matches, line);
+    }
+  }
+  Window_release_pin(self->window, &pin);
+}
+
+// scans [from, to), a round of chunks at a time, and publishes the matches
+// of every round in order, returns false once the line index is full
+static bool Filter_scan(Filter *self, size_t from, size_t to) {
+  size_t round_start = from;
+  while (round_start < to && !atomic_load(&self->stop)) {
+    size_t chunk_count = 0;
+    size_t round_end = round_start;
+    while (chunk_count < self->chunk_count && round_end < to) {
+      size_t chunk_end = (to - round_end > FILTER_CHUNK_LINES) ? round_end + FILTER_CHUNK_LINES : to;
+      self->chunks[chunk_count].first_line = round_end;
+      self->chunks[chunk_count].end_line = chunk_end;
+      round_end = chunk_end;
+      chunk_count += 1;
+    }
+    // NOTE a few new lines are not worth waking the workers for
+    if (chunk_count == 1) { Filter_scan_chunk(self, 0); }
+    else { Pool_run(self->pool, chunk_count, Filter_scan_chunk, self); }
+    if (atomic_load(&self->stop)) { break; }
+
+    for (size_t i = 0; i < chunk_count; i += 1) {
+      FilterChunk *chunk = &self->chunks[i];
+      for (size_t j = 0; j < chunk->matches.item_count; j += 1) {
+        if (!SpscList_size_t_push(&self->lines, chunk->matches.items[j])) {
+          fprintf(stderr, "WARN: filter index is full, the rest of the matches are not shown\n");
+          SpscList_size_t_publish(&self->lines);
+          return false;
+        }
+      }
+    }
+    SpscList_size_t_publish(&self->lines);
+    atomic_store(&self->scanned, round_end);
+    Window_notify(self->window);
+    round_start = round_end;
+  }
+  return true;
+}
+
+static void *Filter_run(void *args) {
+  Filter *self = args;
+  size_t scanned = 0;
+  while (!atomic_load(&self->stop)) {
+    size_t target = atomic_load(&self->target);
+    if (scanned == target) {
+      eventfd_t pending;
+      if (eventfd_read(self->work_fd, &pending) < 0 && errno != EINTR) { break; }
+      continue;
+    }
+    if (!Filter_scan(self, scanned, target)) { break; }
+    scanned = target;
+  }
+  return NULL;
+}
+
+// frees everything but the thread
+static void Filter_release(Filter *self) {
+  for (size_t i = 0; i < self->chunk_count; i += 1) {
+    RegexMatcher_free(self->chunks[i].matcher);
+    List_size_t_free(&self->chunks[i].matches);
+  }
+  free(self->chunks);
+  SpscList_size_t_free(&self->lines);
+  Regex_free(self->regex);
+  close(self->work_fd);
+  free(self);
+}
+
+Filter *Filter_new(Window *window, Pool *pool, const char *pattern, size_t pattern_length, const char **error) {
+  if (pattern_length > SEARCH_PATTERN_MAX) { pattern_length = SEARCH_PATTERN_MAX; }
+  Regex *regex = Regex_compile(pattern, pattern_length, error);
+  if (regex == NULL) { return NULL; }
+
+  Filter *self = calloc(1, sizeof(Filter));
+  self->window = window;
+  self->pool = pool;
+  memcpy(self->pattern, pattern, pattern_length);
+  self->pattern_length = pattern_length;
+  self->regex = regex;
+  self->lines = SpscList_size_t_new();
+  self->chunk_count = FILTER_ROUND_CHUNKS * pool->worker_count;
+  self->chunks = calloc(self->chunk_count, sizeof(FilterChunk));
+  for (size_t i = 0; i < self->chunk_count; i += 1) {
+    self->chunks[i].matcher = RegexMatcher_new(regex);
+    self->chunks[i].matches = List_size_t_new(256);
+  }
+  atomic_init(&self->target, 0);
+  atomic_init(&self->scanned, 0);
+  atomic_init(&self->stop, false);
+  self->work_fd = eventfd(0, EFD_CLOEXEC);
+  if (self->work_fd < 0) {
+    fprintf(stderr, "WARN: failed to create filter eventfd -> %s\n", strerror(errno));
+  }
+  if (pthread_create(&self->thread, NULL, Filter_run, self) != 0) {
+    fprintf(stderr, "WARN: failed to start filter thread\n");
+    Filter_release(self);
+    *error = "failed to start filtering";
+    return NULL;
+  }
+  return self;
+}
+
+bool Filter_update(Filter *self, size_t line_count) {
+  if (line_count > atomic_load(&self->target)) {
+    atomic_store(&self->target, line_count);
+    eventfd_write(self->work_fd, 1);
+  }
+  // NOTE the matches of the scanned lines are published before scanned is
+  // stored, so everything below scanned_count is among the matches taken
+  size_t scanned = atomic_load(&self->scanned);
+  size_t match_count = SpscList_size_t_take(&self->lines);
+  if (scanned == self->scanned_count && match_count == self->match_count) { return false; }
+  self->scanned_count = scanned;
+  self->match_count = match_count;
+  return true;
+}
+
+size_t Filter_index_of(Filter *self, size_t line) {
+  size_t low = 0, high = self->match_count;
+  while (low < high) {
+    size_t middle = low + (high - low) / 2;
+    if (SpscList_at(self->lines, middle) < line) { low = middle + 1; }
+    else { high = middle; }
+  }
+  return low;
+}
+
+void Filter_free(Filter *self) {
+  atomic_store(&self->stop, true);
+  eventfd_write(self->work_fd, 1);
+  pthread_join(self->thread, NULL);
+  Filter_release(self);
+}
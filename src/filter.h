@@ -0,0 +1,66 @@
+#include "stdint.h"
+#include "stddef.h"
+#include "stdbool.h"
+#include "stdatomic.h"
+#include "pthread.h"
+
+#include "interface.h"
+#include "search.h"
+#include "pool.h"
+#include "regex.h"
+
+#ifndef FILTER_H
+#define FILTER_H
+
+// the number of lines scanned by a single pool task
+#define FILTER_CHUNK_LINES (16 * 1024)
+// chunks per worker scanned before their matches are handed to the UI
+#define FILTER_ROUND_CHUNKS 4
+
+// a range of lines scanned by a single pool task, the chunks of a filter
+// are reused from round to round so their matchers stay warm
+typedef struct {
+  size_t first_line, end_line;
+  RegexMatcher *matcher;
+  List_size_t matches;
+} FilterChunk;
+
+// the lines of a window that match a regular expression (see regex.h),
+// shown instead of all of its lines while the window is filtered (&pattern)
+//
+// a thread of its own scans every line the UI has taken, what is already
+// there in rounds of chunks on the pool and then only the lines that stream
+// in after, and pushes the numbers of the matching lines in order onto lines,
+// which the UI reads without locking like the line index of a file
+struct Filter {
+  Window *window;
+  Pool *pool;
+  char pattern[SEARCH_PATTERN_MAX];
+  size_t pattern_length;
+  Regex *regex;
+  SpscList_size_t lines;
+  // the lines of the window there are to scan, raised by the UI as it takes
+  // them, and the lines scanned so far (the matches among them are published)
+  _Atomic size_t target;
+  _Atomic size_t scanned;
+  // both as of the last Filter_update, which the UI reads so they agree
+  size_t scanned_count, match_count;
+  FilterChunk *chunks;
+  size_t chunk_count;
+  _Atomic bool stop;
+  // an eventfd the UI signals when the target is raised
+  int work_fd;
+  pthread_t thread;
+};
+
+// returns NULL and points error at a message if pattern is invalid
+Filter *Filter_new(Window *window, Pool *pool, const char *pattern, size_t pattern_length, const char **error);
+// has the lines the window has taken (line_count) scanned and takes the
+// matches published so far, returns whether there were any new ones
+bool Filter_update(Filter *self, size_t line_count);
+// the first index in lines holding a line >= line, or match_count
+size_t Filter_index_of(Filter *self, size_t line);
+// stops the thread, it is done with the window's lines once this returns
+void Filter_free(Filter *self);
+
+#endif
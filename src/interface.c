@@ -1,3 +1,6 @@
+// F_SETPIPE_SZ
+#define _GNU_SOURCE
+
 
 #include "stddef.h"
 #include "stdint.h"
@@ -10,8 +13,21 @@
 #include "sys/ioctl.h"
 #include "errno.h"
 #include "pthread.h"
+#include "sys/mman.h"
+#include "sys/stat.h"
+#include "sys/eventfd.h"
+#include "sys/inotify.h"
+#include "fcntl.h"
+#include "poll.h"
+#include "signal.h"
+#include "time.h"
 
 #include "interface.h"
+#include "scan.h"
+#include "search.h"
+#include "filter.h"
+#include "merge.h"
+#include "width.h"
 
 #include "plustypes.h"
 #include <bits/pthreadtypes.h>
@@ -32,14 +48,6 @@ const char *MAKE_CURSOR_VISIBLE_SEQUENCE = "\x1b[?25h";
 const char *ENTER_ALTERNATE_SCREEN = "\x1b[?1049h";
 const char *LEAVE_ALTERNATE_SCREEN = "\x1b[?1049l";
 
-void move_cursor_to_col(FILE *stream, size_t col_num) {
-  fprintf(stream, "\x1b[%luG", col_num);
-}
-
-void move_cursor_to_position(FILE *stream, size_t row, size_t col) {
-  fprintf(stream, "\x1b[%zu;%zuf", row, col);
-}
-
 
 struct termios original_terminal_state;
 void save_terminal() {
@@ -65,11 +73,20 @@ void enter_raw_mode() {
       fprintf(stderr, "WARN: unable to set raw mode for terminal");
     }
     fprintf(stdout, "%s", MAKE_CURSOR_INVISIBLE_SEQUENCE);
+    // frames bypass stdio, so anything buffered has to reach the terminal first
+    fflush(stdout);
   }else { fprintf(stderr, "WARN: stdout is not a tty"); }
 }
 
 
-define_List(CharString)
+define_SpscList(size_t)
+define_SpscList(LineStamp)
+
+uint64_t line_stamp_now() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
+  return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
 
 
 size_t base_10_digits(size_t number) {
@@ -128,185 +145,1509 @@ void free_residuals() {
   pthread_mutex_unlock(&residuals_mutex);
 }
 
-void *Window_read_blocking(void *args) {
-  Window *self = args;
-  FILE *source_stream;
-  source_stream = fdopen(self->source_fd, "r");
-  pthread_mutex_lock(&residuals_mutex);
-  Residual *res = FillAllocator_talloc(&residuals_alloc, Residual, 1);
-  *res = (Residual) {
-    .type = RESIDUAL_STREAM,
-    .residual = source_stream
-  };
-  pthread_mutex_unlock(&residuals_mutex);
+// streams are read straight into the line store, into at least this much
+// room at a time and at most this much in one read
+#define STREAM_READ_MIN (4 * 1024)
+#define STREAM_READ_MAX (1024 * 1024)
+// the buffer asked for on a pipe, so that a fast writer is not stopped
+// every 64KiB until the reader catches up
+#define STREAM_PIPE_SIZE (1024 * 1024)
+
+// wakes the main loop, many notifications before it runs collapse into one
+void Window_notify(Window *self) {
+  eventfd_write(self->wake_fd, 1);
+  if (self->merge_wake_fd >= 0) { eventfd_write(self->merge_wake_fd, 1); }
+}
+
+// the lines ended from here on were read at time, a stamp is only pushed
+// when the clock moved since the last one
+void Window_stamp_lines(Window *self, uint64_t time) {
+  size_t stamp_count = self->stamps.pushed_count;
+  if (stamp_count > 0 && SpscList_at(self->stamps, stamp_count - 1).time == time) { return; }
+  // NOTE a stream that outgrows the stamps keeps the time of the last one
+  SpscList_LineStamp_push(&self->stamps, (LineStamp){ .first_line = self->store.line_count, .time = time });
+}
 
-  char read_buffer[512];
+void Window_push_line(Window *self) {
+  // NOTE only the reader thread writes to the store, and the line is not
+  // visible to the UI until the batch it is in gets published
+  LineStore_end_line(&self->store);
+}
+
+// prints how fast the stream was read once it ends (see --throughput)
+void Window_report_throughput(Window *self, size_t bytes, struct timespec started) {
+  struct timespec finished;
+  clock_gettime(CLOCK_MONOTONIC, &finished);
+  double seconds = (finished.tv_sec - started.tv_sec) + (finished.tv_nsec - started.tv_nsec) / 1e9;
+  fprintf(stderr, "THROUGHPUT: fd %i bytes %zu lines %zu seconds %.3f MB/s %.1f\n",
+    self->source_fd, bytes, self->store.line_count, seconds, (seconds > 0) ? bytes / seconds / 1e6 : 0.0
+  );
+}
 
+void *Window_read_blocking(void *args) {
+  Window *self = args;
+  // the reader is the only consumer so blocking reads are what we want
+  int fd_flags = fcntl(self->source_fd, F_GETFL);
+  if (fd_flags >= 0) { fcntl(self->source_fd, F_SETFL, fd_flags & ~O_NONBLOCK); }
+  // NOTE fails on anything but a pipe, or past /proc/sys/fs/pipe-max-size,
+  // which only costs more wakeups
+  fcntl(self->source_fd, F_SETPIPE_SZ, STREAM_PIPE_SIZE);
+
+  struct timespec started;
+  clock_gettime(CLOCK_MONOTONIC, &started);
+  size_t bytes_read = 0;
+  // NOTE nothing is read yet, so whatever is will be stamped after this
+  atomic_store(&self->drained, true);
   while (1) {
-    // if (self->next_line_is_ready == false) {
-    char *reading_ended = fgets(read_buffer, 512, source_stream);
+    // the bytes are read into the block the lines will live in, so
+    // nothing is copied between the pipe and the store
+    char *tail = NULL;
+    size_t available = 0;
+    suspend_cancelation({ tail = LineStore_tail(&self->store, STREAM_READ_MIN, &available); });
+    if (available > STREAM_READ_MAX) { available = STREAM_READ_MAX; }
+    // NOTE the store is full, what is left of the stream is not shown
+    ssize_t read_size = (tail != NULL) ? read(self->source_fd, tail, available) : 0;
+    if (read_size < 0 && errno == EINTR) { continue; }
+    // the lines are stamped when the read returns, a merge that saw the
+    // reader drained before this is sure to see a stamp no older than its own
+    atomic_store(&self->drained, false);
+    uint64_t stamp = line_stamp_now();
+    atomic_store(&self->read_stamp, stamp);
     suspend_cancelation({
-      if (reading_ended == NULL) {
-        if (errno != 0) {
+      if (read_size <= 0) {
+        if (read_size < 0) {
           fprintf(stderr, "WARN: encountered a read error before EOF -> %s\n", strerror(errno));
         }
+        // the last line does not have to end in a newline
+        if (self->store.line_is_open) {
+          Window_stamp_lines(self, stamp);
+          Window_push_line(self);
+        }
+        SpscList_LineStamp_publish(&self->stamps);
+        LineStore_publish(&self->store);
+        atomic_store(&self->indexed, true);
+        Window_notify(self);
+        if (self->report_throughput) { Window_report_throughput(self, bytes_read, started); }
         return NULL;
       }
 
-      size_t string_len = strlen(read_buffer);
-      char *new_string = malloc(string_len);
-      memcpy(new_string, read_buffer, string_len);
-      new_string[string_len-1] = '\0';
-
-      pthread_mutex_lock(&self->new_lines_mutex);
-      List_CharString_push(&self->new_lines, new_string);
-      // self->next_line = new_string;
-      // self->next_line_is_ready = true;
-      pthread_mutex_unlock(&self->new_lines_mutex);
+      // every line from this read becomes visible to the UI in one step,
+      // after the stamps that cover them
+      Window_stamp_lines(self, stamp);
+      LineStore_commit_tail(&self->store, read_size);
+      bytes_read += read_size;
+      SpscList_LineStamp_publish(&self->stamps);
+      LineStore_publish(&self->store);
+      atomic_store(&self->drained, true);
+      Window_notify(self);
     });
-    // }
-    // else {
-    //   usleep(10);
-    // }
   }
 
 }
 
-Window Window_new(int source) {
+// the address space reserved for a file, it is only ever backed by
+// the pages of the file that have been mapped into it
+#define FILE_MAP_RESERVE ((size_t)1 << 40)
+
+size_t page_round_up(size_t size) {
+  size_t page_size = sysconf(_SC_PAGESIZE);
+  return (size + page_size - 1) / page_size * page_size;
+}
+
+// maps the first file_size bytes of the window's file at the start of a
+// freshly reserved range of address space
+// the address space reserved for every mapped file, so the SIGBUS handler
+// only stands in for pages of a file (see handle_truncated_map), a slot is
+// free while its start is 0
+//
+// NOTE only the UI thread maps and unmaps files, the handler only reads
+#define FILE_MAP_SLOTS 256
+static _Atomic uintptr_t file_map_starts[FILE_MAP_SLOTS];
+static _Atomic size_t file_map_sizes[FILE_MAP_SLOTS];
+
+static void register_file_map(const char *start, size_t size) {
+  for (size_t i = 0; i < FILE_MAP_SLOTS; i += 1) {
+    if (atomic_load(&file_map_starts[i]) != 0) { continue; }
+    // the size goes first, a handler that sees the start sees it too
+    atomic_store(&file_map_sizes[i], size);
+    atomic_store(&file_map_starts[i], (uintptr_t)start);
+    return;
+  }
+  fprintf(stderr, "WARN: too many mapped files, truncating this one will not be survived\n");
+}
+
+// before the range is unmapped
+static void unregister_file_map(const char *start) {
+  for (size_t i = 0; i < FILE_MAP_SLOTS; i += 1) {
+    if (atomic_load(&file_map_starts[i]) == (uintptr_t)start) { atomic_store(&file_map_starts[i], 0); }
+  }
+}
+
+static bool in_file_map(uintptr_t address) {
+  for (size_t i = 0; i < FILE_MAP_SLOTS; i += 1) {
+    uintptr_t start = atomic_load(&file_map_starts[i]);
+    if (start != 0 && address >= start && address - start < atomic_load(&file_map_sizes[i])) { return true; }
+  }
+  return false;
+}
+
+bool Window_map_file(Window *self, size_t file_size) {
+  size_t reserve = page_round_up(file_size) * 2;
+  if (reserve < FILE_MAP_RESERVE) { reserve = FILE_MAP_RESERVE; }
+  void *region = mmap(NULL, reserve, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (region == MAP_FAILED) { return false; }
+  if (file_size > 0) {
+    if (mmap(region, file_size, PROT_READ, MAP_SHARED | MAP_FIXED, self->source_fd, 0) == MAP_FAILED) {
+      munmap(region, reserve);
+      return false;
+    }
+    madvise(region, file_size, MADV_SEQUENTIAL);
+  }
+  self->file_map = region;
+  self->file_map_reserved = reserve;
+  register_file_map(region, reserve);
+  self->file_size = file_size;
+  self->index_size = file_size;
+  atomic_store(&self->indexed_bytes, 0);
+  return true;
+}
+
+// maps the pages the file grew by right after the ones already mapped,
+// so every pointer into the mapping stays valid
+bool Window_grow_map(Window *self, size_t file_size) {
+  if (file_size > self->file_map_reserved) {
+    fprintf(stderr, "WARN: followed file outgrew its reserved address space\n");
+    return false;
+  }
+  size_t mapped = page_round_up(self->file_size);
+  size_t wanted = page_round_up(file_size);
+  if (wanted > mapped) {
+    void *tail = (char *)self->file_map + mapped;
+    if (mmap(tail, wanted - mapped, PROT_READ, MAP_SHARED | MAP_FIXED, self->source_fd, mapped) == MAP_FAILED) {
+      fprintf(stderr, "WARN: failed to map the end of a followed file -> %s\n", strerror(errno));
+      return false;
+    }
+  }
+  self->file_size = file_size;
+  return true;
+}
+
+// indexes the lines of [from, to) one after another, see Window_index_range
+size_t Window_index_sequential(Window *self, size_t from, size_t to) {
+  const size_t INDEX_BATCH_SIZE = 4096;
+
+  const char *cursor = self->file_map + from;
+  const char *end = self->file_map + to;
+  const char *newline;
+  while ((newline = scan_byte(cursor, end, '\n')) != NULL) {
+    if (!SpscList_size_t_push(&self->line_ends, newline - self->file_map)) {
+      fprintf(stderr, "WARN: window line index is full, the rest of the file is not shown\n");
+      cursor = end;
+      break;
+    }
+    cursor = newline + 1;
+
+    if (self->line_ends.pushed_count % INDEX_BATCH_SIZE == 0) {
+      SpscList_size_t_publish(&self->line_ends);
+      Window_notify(self);
+      // scanning the mapping has no cancelation points of its own
+      pthread_testcancel();
+    }
+  }
+  SpscList_size_t_publish(&self->line_ends);
+  atomic_store(&self->indexed_bytes, to);
+  Window_notify(self);
+  return cursor - self->file_map;
+}
+
+// the start of the mapping is indexed on the reader alone and shown right
+// away, the rest is split into chunks that are indexed on the pool
+#define INDEX_HEAD_SIZE ((size_t)1 << 20)
+#define INDEX_CHUNK_SIZE ((size_t)1 << 21)
+// chunks per worker indexed before their lines are handed to the UI
+#define INDEX_ROUND_CHUNKS 4
+
+typedef struct {
+  size_t start, end;
+  // the offsets of the newlines in [start, end)
+  List_size_t ends;
+} IndexChunk;
+
+typedef struct {
+  const char *file_map;
+  IndexChunk *chunks;
+  size_t chunk_count;
+} IndexRound;
+
+void Window_index_chunk(void *context, size_t task) {
+  IndexRound *round = context;
+  IndexChunk *chunk = &round->chunks[task];
+  chunk->ends.item_count = 0;
+  const char *cursor = round->file_map + chunk->start;
+  const char *end = round->file_map + chunk->end;
+  const char *newline;
+  while ((newline = scan_byte(cursor, end, '\n')) != NULL) {
+    List_size_t_push(&chunk->ends, newline - round->file_map);
+    cursor = newline + 1;
+  }
+}
+
+void free_index_round(void *args) {
+  IndexRound *round = args;
+  for (size_t i = 0; i < round->chunk_count; i += 1) { List_size_t_free(&round->chunks[i].ends); }
+  free(round->chunks);
+}
+
+// indexes [from, to) a round of chunks at a time, every chunk of a round is
+// scanned in parallel into a list of its own and the lists are appended to
+// the line index in order, indexed_end is where the first line not indexed
+// started before from
+size_t Window_index_parallel(Window *self, size_t from, size_t to, size_t indexed_end) {
+  IndexRound round = {
+    .file_map = self->file_map,
+    .chunk_count = INDEX_ROUND_CHUNKS * self->pool->worker_count,
+  };
+  round.chunks = calloc(round.chunk_count, sizeof(IndexChunk));
+  for (size_t i = 0; i < round.chunk_count; i += 1) { round.chunks[i].ends = List_size_t_new(1024); }
+  pthread_cleanup_push(free_index_round, &round);
+
+  size_t round_start = from;
+  while (round_start < to) {
+    size_t chunk_count = 0;
+    size_t round_end = round_start;
+    while (chunk_count < round.chunk_count && round_end < to) {
+      size_t chunk_end = (to - round_end > INDEX_CHUNK_SIZE) ? round_end + INDEX_CHUNK_SIZE : to;
+      round.chunks[chunk_count].start = round_end;
+      round.chunks[chunk_count].end = chunk_end;
+      round_end = chunk_end;
+      chunk_count += 1;
+    }
+    // NOTE a canceled thread must not leave the pool in the middle of a job
+    suspend_cancelation({ Pool_run(self->pool, chunk_count, Window_index_chunk, &round); });
+
+    bool full = false;
+    for (size_t i = 0; i < chunk_count && !full; i += 1) {
+      IndexChunk *chunk = &round.chunks[i];
+      for (size_t j = 0; j < chunk->ends.item_count; j += 1) {
+        if (!SpscList_size_t_push(&self->line_ends, chunk->ends.items[j])) {
+          fprintf(stderr, "WARN: window line index is full, the rest of the file is not shown\n");
+          full = true;
+          break;
+        }
+        indexed_end = chunk->ends.items[j] + 1;
+      }
+    }
+    SpscList_size_t_publish(&self->line_ends);
+    atomic_store(&self->indexed_bytes, round_end);
+    Window_notify(self);
+    if (full) {
+      indexed_end = to;
+      break;
+    }
+    round_start = round_end;
+    pthread_testcancel();
+  }
+
+  pthread_cleanup_pop(1);
+  return indexed_end;
+}
+
+// indexes the lines of the mapping in [from, to) and returns where the
+// first line not indexed starts, a final line without a newline is left out
+size_t Window_index_range(Window *self, size_t from, size_t to) {
+  if (self->pool == NULL || to - from <= INDEX_HEAD_SIZE) { return Window_index_sequential(self, from, to); }
+  size_t head_end = from + INDEX_HEAD_SIZE;
+  size_t indexed_end = Window_index_sequential(self, from, head_end);
+  // NOTE the head may have filled the line index already
+  if (self->line_ends.pushed_count == SPSC_MAX_SEGMENTS * SPSC_SEGMENT_SIZE) { return to; }
+  return Window_index_parallel(self, head_end, to, indexed_end);
+}
+
+// watches the file for appends and its directory for a new file taking its path
+int Window_watch_file(Window *self) {
+  int inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (inotify_fd < 0) {
+    fprintf(stderr, "WARN: failed to create inotify instance, following will not work -> %s\n", strerror(errno));
+    return -1;
+  }
+  char watched[4096];
+  if (self->path != NULL) { snprintf(watched, sizeof(watched), "%s", self->path); }
+  else { snprintf(watched, sizeof(watched), "/proc/self/fd/%i", self->source_fd); }
+  if (inotify_add_watch(inotify_fd, watched, IN_MODIFY | IN_ATTRIB | IN_MOVE_SELF | IN_DELETE_SELF) < 0) {
+    fprintf(stderr, "WARN: failed to watch followed file -> %s\n", strerror(errno));
+  }
+  if (self->path != NULL) {
+    char *slash = strrchr(watched, '/');
+    if (slash == NULL) { snprintf(watched, sizeof(watched), "."); }
+    else if (slash == watched) { watched[1] = '\0'; }
+    else { *slash = '\0'; }
+    inotify_add_watch(inotify_fd, watched, IN_CREATE | IN_MOVED_TO);
+  }
+  return inotify_fd;
+}
+
+void close_fd_cleanup(void *fd) {
+  if (*(int *)fd >= 0) { close(*(int *)fd); }
+}
+
+// waits for the file to grow while the window follows it and indexes what
+// was appended, returns once the file has to be reopened
+void Window_follow_file(Window *self, size_t indexed_end) {
+  int inotify_fd = -1;
+  pthread_cleanup_push(close_fd_cleanup, &inotify_fd);
+
+  while (1) {
+    if (atomic_load(&self->following)) {
+      if (inotify_fd < 0) { inotify_fd = Window_watch_file(self); }
+
+      struct stat file_stat;
+      if (fstat(self->source_fd, &file_stat) == 0) {
+        size_t file_size = file_stat.st_size;
+        if (file_size < self->file_size) {
+          atomic_store(&self->needs_reopen, true);
+          Window_notify(self);
+          break;
+        }
+        if (file_size > self->file_size && Window_grow_map(self, file_size)) {
+          indexed_end = Window_index_range(self, indexed_end, file_size);
+        }
+
+        // whatever was appended to a rotated file is read before moving to its replacement
+        struct stat path_stat;
+        if (self->path != NULL && stat(self->path, &path_stat) == 0
+          && (path_stat.st_ino != file_stat.st_ino || path_stat.st_dev != file_stat.st_dev)
+        ) {
+          atomic_store(&self->needs_reopen, true);
+          Window_notify(self);
+          break;
+        }
+      }
+    }
+
+    // NOTE poll skips negative fds, so inotify is only watched once following starts
+    struct pollfd poll_fds[2] = {
+      { .fd = self->follow_fd, .events = POLLIN },
+      { .fd = inotify_fd, .events = POLLIN },
+    };
+    if (poll(poll_fds, 2, -1) < 0 && errno != EINTR) {
+      fprintf(stderr, "WARN: failed to wait for followed file -> %s\n", strerror(errno));
+      break;
+    }
+    eventfd_t pending;
+    eventfd_read(self->follow_fd, &pending);
+    char events[4096];
+    while (inotify_fd >= 0 && read(inotify_fd, events, sizeof(events)) > 0) {}
+  }
+  pthread_cleanup_pop(1);
+}
+
+// builds the line index of a file backed window in the background
+// so that the first lines can be rendered before the whole file is scanned,
+// then follows the file as it grows
+void *Window_index_blocking(void *args) {
+  Window *self = args;
+  if (self->file_map == NULL) {
+    atomic_store(&self->indexed, true);
+    Window_notify(self);
+    return NULL;
+  }
+
+  size_t indexed_end = Window_index_range(self, 0, self->file_size);
+  if (indexed_end < self->file_size && !atomic_load(&self->following)) {
+    // the last line does not have to end in a newline
+    // NOTE if the file is followed later, what gets appended to it becomes a line of its own
+    SpscList_size_t_push(&self->line_ends, self->file_size);
+    SpscList_size_t_publish(&self->line_ends);
+    indexed_end = self->file_size;
+  }
+  atomic_store(&self->indexed, true);
+  Window_notify(self);
+  Window_follow_file(self, indexed_end);
+  return NULL;
+}
+
+static void Window_clear_line_cache(Window *self) {
+  for (size_t i = 0; i < WINDOW_LINE_CACHE_SIZE; i += 1) {
+    self->line_cache[i].line = SIZE_MAX;
+  }
+}
+
+Window Window_new(int source, const char *path, size_t memory_budget, Pool *pool) {
   Window self = {
-    .lines = List_CharString_new(8),
+    .source_type = WINDOW_SOURCE_STREAM,
+    .line_count = 0,
     .window_start = 0,
+    .column_start = 0,
+    .wrap = false,
+    .row_start = 0,
+    // NOTE set to the frame's width on the first render
+    .wrap_width = 1,
+    .wrap_blocks = NULL,
+    .wrap_block_capacity = 0,
+    .indexed = false,
+    .fully_indexed = false,
+    .jump = { .type = WINDOW_JUMP_NONE },
+    .marked_line = SIZE_MAX,
+    .filter = NULL,
+    .from_stderr = false,
+    .merge = NULL,
+    .hidden = false,
+    .merge_wake_fd = -1,
     .source_fd = source,
-    .new_lines = List_CharString_new(8),
-    .new_lines_mutex = PTHREAD_MUTEX_INITIALIZER,
+    .wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC),
+    .follow_fd = -1,
+    .file_map = NULL,
+    .file_size = 0,
+    .index_size = 0,
+    .indexed_bytes = 0,
+    .pool = pool,
+    .path = path,
   };
+
+  // regular files are mapped rather than read so that only
+  // the line index has to live on the heap
+  struct stat source_stat;
+  if (fstat(source, &source_stat) == 0 && S_ISREG(source_stat.st_mode)) {
+    self.source_type = WINDOW_SOURCE_FILE;
+    if (!Window_map_file(&self, source_stat.st_size)) {
+      fprintf(stderr, "WARN: failed to map file, falling back to reading it -> %s\n", strerror(errno));
+      self.source_type = WINDOW_SOURCE_STREAM;
+    }
+  }
+  if (self.wake_fd < 0) {
+    fprintf(stderr, "WARN: failed to create window eventfd, new lines will not wake the screen -> %s\n", strerror(errno));
+  }
+  self.line_cache = calloc(WINDOW_LINE_CACHE_SIZE, sizeof(LineCache));
+  Window_clear_line_cache(&self);
+  if (self.source_type == WINDOW_SOURCE_FILE) {
+    self.line_ends = SpscList_size_t_new();
+    self.follow_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  }else {
+    self.store = LineStore_new(memory_budget);
+    self.stamps = SpscList_LineStamp_new();
+    atomic_init(&self.drained, false);
+    atomic_init(&self.read_stamp, 0);
+  }
+  return self;
+}
+
+Window Window_new_merged(Window **sources, uint8_t source_count) {
+  Window self = {
+    .source_type = WINDOW_SOURCE_MERGED,
+    .wrap_width = 1,
+    .jump = { .type = WINDOW_JUMP_NONE },
+    .marked_line = SIZE_MAX,
+    .source_fd = -1,
+    .wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC),
+    .follow_fd = -1,
+    .merge_wake_fd = -1,
+    .pool = sources[0]->pool,
+  };
+  if (self.wake_fd < 0) {
+    fprintf(stderr, "WARN: failed to create window eventfd, new lines will not wake the screen -> %s\n", strerror(errno));
+  }
+  self.line_cache = calloc(WINDOW_LINE_CACHE_SIZE, sizeof(LineCache));
+  Window_clear_line_cache(&self);
+  self.merge = Merge_new(sources, source_count);
+  // NOTE the sources are only read by their own readers, which wake this
+  // window too once they publish
+  for (uint8_t i = 0; i < source_count; i += 1) {
+    sources[i]->hidden = true;
+    sources[i]->merge_wake_fd = self.wake_fd;
+  }
   return self;
 }
 
 // WARN self must outlive the lifetime of the spawned thread
 void Window_spawn_reader(Window *self) {
+  // NOTE a merged window is kept up to date by the readers of its sources
+  if (self->source_type == WINDOW_SOURCE_MERGED) { return; }
   pthread_t reader_thread_id;
-  pthread_create(&reader_thread_id, NULL, Window_read_blocking, self);
+  if (self->source_type == WINDOW_SOURCE_FILE) {
+    pthread_create(&reader_thread_id, NULL, Window_index_blocking, self);
+  }else {
+    pthread_create(&reader_thread_id, NULL, Window_read_blocking, self);
+  }
   self->reader_thread = reader_thread_id;
 }
 
-void push_buffer_line(char *buffer, size_t start_index, size_t buffer_index, List_CharString *line_buffer) {
-  char *line_string = malloc(buffer_index+1);
-  memcpy(line_string, buffer + start_index, buffer_index-1);
+void Window_set_following(Window *self, bool following) {
+  atomic_store(&self->following, following);
+  self->stick_to_bottom = following;
+  // NOTE stream readers always read to the end, only file readers wait to be told
+  if (self->source_type == WINDOW_SOURCE_FILE) { eventfd_write(self->follow_fd, 1); }
+}
 
-  line_string[buffer_index] = '\0';
-  List_CharString_push(line_buffer, (CharString){ line_string });
+bool Window_needs_reopen(Window *self) { return atomic_load(&self->needs_reopen); }
+
+// reopens the file of a window after it was truncated or replaced
+// and starts indexing it again from the start
+void Window_reopen(Window *self) {
+  pthread_join(self->reader_thread, NULL);
+  atomic_store(&self->needs_reopen, false);
+  unregister_file_map(self->file_map);
+  munmap((void *)self->file_map, self->file_map_reserved);
+  self->file_map = NULL;
+  SpscList_size_t_free(&self->line_ends);
+  self->line_ends = SpscList_size_t_new();
+  self->line_count = 0;
+  self->window_start = 0;
+  self->row_start = 0;
+  self->column_start = 0;
+  Window_clear_line_cache(self);
+  for (size_t i = 0; i < self->wrap_block_capacity; i += 1) { self->wrap_blocks[i] = 0; }
+  self->marked_line = SIZE_MAX;
+  atomic_store(&self->indexed, false);
+  self->fully_indexed = false;
+  self->jump.type = WINDOW_JUMP_NONE;
+
+  if (self->path != NULL) {
+    int file_fd = open(self->path, O_RDONLY | O_CLOEXEC);
+    if (file_fd < 0) {
+      fprintf(stderr, "WARN: failed to reopen followed file -> %s\n", strerror(errno));
+    }else {
+      // the window keeps its fd number, whoever opened it still closes it
+      dup2(file_fd, self->source_fd);
+      close(file_fd);
+    }
+  }
+  struct stat file_stat;
+  size_t file_size = (fstat(self->source_fd, &file_stat) == 0) ? file_stat.st_size : 0;
+  if (!Window_map_file(self, file_size)) {
+    fprintf(stderr, "WARN: failed to map reopened file -> %s\n", strerror(errno));
+  }
+  Window_spawn_reader(self);
 }
 
 bool Window_update(Window *self) {
+  // NOTE this is the only place the UI thread synchronizes with the reader,
+  // every line published so far is taken in one atomic load, after the
+  // flag so that a window that is indexed has all of its lines taken
+  bool indexed = atomic_load(&self->indexed);
+  size_t published = 0;
+  if (self->source_type == WINDOW_SOURCE_MERGED) {
+    // the lines of the sources published since are merged here
+    Merge_update(self->merge);
+    indexed = self->merge->complete;
+    published = SpscList_size_t_take(&self->merge->entries);
+  }else if (self->source_type == WINDOW_SOURCE_FILE) {
+    published = SpscList_size_t_take(&self->line_ends);
+  }else { published = LineStore_published(&self->store); }
+  bool updated = published != self->line_count || indexed != self->fully_indexed;
+  self->line_count = published;
+  self->fully_indexed = indexed;
+  // the filter is handed the new lines here too, and its new matches taken
+  if (self->filter != NULL) { updated |= Filter_update(self->filter, published); }
+  return updated;
+}
+
+size_t Window_expected_line_count(Window *self) {
+  size_t line_count = Window_line_count(self);
+  if (self->source_type != WINDOW_SOURCE_FILE || self->fully_indexed || line_count == 0) { return line_count; }
+  size_t indexed_bytes = SpscList_at(self->line_ends, line_count - 1) + 1;
+  if (indexed_bytes >= self->index_size) { return line_count; }
+  return (size_t)((double)line_count / indexed_bytes * self->index_size);
+}
+
+void Window_acknowledge_wake(Window *self) {
+  eventfd_t pending;
+  eventfd_read(self->wake_fd, &pending);
+}
+
+size_t Window_line_count(Window *self) { return self->line_count; }
+
+size_t Window_view_count(Window *self) {
+  return (self->filter != NULL) ? self->filter->match_count : self->line_count;
+}
+
+size_t Window_view_line(Window *self, size_t index) {
+  return (self->filter != NULL) ? SpscList_at(self->filter->lines, index) : index;
+}
+
+size_t Window_view_index(Window *self, size_t line) {
+  return (self->filter != NULL) ? Filter_index_of(self->filter, line) : line;
+}
 
-  if (self->new_lines.item_count > 0) {
-    pthread_mutex_lock(&self->new_lines_mutex);
-    List_CharString_pushall(&self->lines, &self->new_lines);
-    self->new_lines.item_count = 0;
-    // self->next_line_is_ready = false;
-    pthread_mutex_unlock(&self->new_lines_mutex);
-    return true;
+const char *Window_set_filter(Window *self, const char *pattern, size_t pattern_length) {
+  Filter *filter = NULL;
+  if (pattern_length > 0) {
+    const char *error = NULL;
+    filter = Filter_new(self, self->pool, pattern, pattern_length, &error);
+    if (filter == NULL) { return error; }
   }
-  // if (self->next_line_is_ready) {
-  // }
-  return false;
+  // NOTE showing every line again keeps the line that was at the top there
+  size_t top = (Window_view_count(self) > 0) ? Window_view_line(self, self->window_start) : 0;
+  if (self->filter != NULL) { Filter_free(self->filter); }
+  self->filter = filter;
+  if (filter != NULL) { Filter_update(filter, self->line_count); }
+  self->window_start = (filter != NULL) ? 0 : top;
+  self->row_start = 0;
+  for (size_t i = 0; i < self->wrap_block_capacity; i += 1) { self->wrap_blocks[i] = 0; }
+  return NULL;
+}
+
+LineView Window_get_line(Window *self, size_t index, LinePin *pin) {
+  if (self->source_type == WINDOW_SOURCE_FILE) {
+    size_t line_start = (index == 0) ? 0 : SpscList_at(self->line_ends, index - 1) + 1;
+    return (LineView){
+      .data = self->file_map + line_start,
+      .length = SpscList_at(self->line_ends, index) - line_start,
+    };
+  }
+  if (self->source_type == WINDOW_SOURCE_MERGED) {
+    size_t entry = SpscList_at(self->merge->entries, index);
+    uint8_t source = MERGE_ENTRY_SOURCE(entry);
+    // NOTE a pin only holds a block of one store, it lets go of it when
+    // the line comes from another source
+    if (pin->held && pin->source != source) {
+      Window_release_pin(self->merge->sources[pin->source].window, pin);
+    }
+    pin->source = source;
+    return Window_get_line(self->merge->sources[source].window, MERGE_ENTRY_LINE(entry), pin);
+  }
+  LineView line;
+  line.data = LineStore_get_line(&self->store, index, pin, &line.length);
+  return line;
 }
 
+void Window_release_pin(Window *self, LinePin *pin) {
+  if (self->source_type == WINDOW_SOURCE_STREAM) { LineStore_release_pin(&self->store, pin); }
+  else if (self->source_type == WINDOW_SOURCE_MERGED && pin->held) {
+    Window_release_pin(self->merge->sources[pin->source].window, pin);
+  }
+}
+
+bool Window_line_from_stderr(Window *self, size_t index) {
+  if (self->source_type != WINDOW_SOURCE_MERGED) { return self->from_stderr; }
+  size_t entry = SpscList_at(self->merge->entries, index);
+  return self->merge->sources[MERGE_ENTRY_SOURCE(entry)].window->from_stderr;
+}
+
+// looks up line index in the line cache, parsing its escape sequences
+// the first time it is shown, and points line at the text to draw
+static LineCache *Window_cache_line(Window *self, size_t index, LineView *line) {
+  LineCache *cached = &self->line_cache[index % WINDOW_LINE_CACHE_SIZE];
+  if (cached->line != index) {
+    cached->line = index;
+    cached->styled = sgr_parse(line->data, line->length, &cached->text);
+    cached->column_target = 0;
+    cached->column_offset = 0;
+    cached->column = 0;
+    cached->rows_width = 0;
+  }
+  if (cached->styled) { *line = (LineView){ .data = cached->text.text, .length = cached->text.length }; }
+  return cached;
+}
+
+// returns the offset of the first character of a cached line that is visible
+// with the window scrolled column_start columns to the right and its column
+static size_t Window_skip_columns(Window *self, LineCache *cached, LineView line, size_t *column) {
+  size_t offset = 0, from_column = 0;
+  if (cached->column_target <= self->column_start) {
+    offset = cached->column_offset;
+    from_column = cached->column;
+  }
+  offset += text_skip_columns(line.data + offset, line.length - offset, from_column, self->column_start, column);
+  cached->column_target = self->column_start;
+  cached->column_offset = offset;
+  cached->column = *column;
+  return offset;
+}
+
+// draws the bytes [text_offset, text_end) of a cached line at col, in the
+// styles of its spans if it has any, text_column is the display column
+// they start at in the line (or in the row while wrapping)
+static uint16_t Window_put_text(
+  Canvas *canvas, uint16_t row, uint16_t col, uint16_t end_col,
+  LineCache *cached, LineView line, size_t text_offset, size_t text_end, size_t text_column
+) {
+  if (!cached->styled) {
+    return Canvas_put_text_at(
+      canvas, row, col, end_col,
+      line.data + text_offset, text_end - text_offset, STYLE_DEFAULT, text_column
+    );
+  }
+  StyledText *styled = &cached->text;
+  uint32_t span = StyledText_span_at(styled, text_offset);
+  while (text_offset < text_end && col < end_col) {
+    size_t span_end = (span + 1 < styled->span_count) ? styled->spans[span + 1].offset : styled->length;
+    if (span_end > text_end) { span_end = text_end; }
+    uint16_t next_col = Canvas_put_text_at(
+      canvas, row, col, end_col,
+      styled->text + text_offset, span_end - text_offset, styled->spans[span].style, text_column
+    );
+    text_column += next_col - col;
+    col = next_col;
+    text_offset = span_end;
+    span += 1;
+  }
+  return col;
+}
+
+// the rows a cached line takes when it is wrapped at wrap_width
+static size_t Window_cache_rows(Window *self, LineCache *cached, LineView line) {
+  if (cached->rows_width != self->wrap_width) {
+    cached->rows = text_rows(line.data, line.length, self->wrap_width);
+    cached->rows_width = self->wrap_width;
+    cached->row_target = 0;
+    cached->row_offset = 0;
+  }
+  return cached->rows;
+}
+
+// the offset of a row of a cached line wrapped at wrap_width, picking up
+// from the row it was asked for last time when that was an earlier one
+//
+// NOTE only asked for the line at the top of the frame
+static size_t Window_row_offset(Window *self, LineCache *cached, LineView line, size_t row) {
+  size_t offset = 0, from_row = 0;
+  if (cached->row_target <= row) {
+    offset = cached->row_offset;
+    from_row = cached->row_target;
+  }
+  for (; from_row < row && offset < line.length; from_row += 1) {
+    offset += text_wrap_row(line.data + offset, line.length - offset, self->wrap_width);
+  }
+  cached->row_target = row;
+  cached->row_offset = offset;
+  return offset;
+}
+
+// drops the wrap index when lines are to be wrapped at another width
+static void Window_set_wrap_width(Window *self, size_t width) {
+  if (width == self->wrap_width) { return; }
+  self->wrap_width = width;
+  for (size_t i = 0; i < self->wrap_block_capacity; i += 1) { self->wrap_blocks[i] = 0; }
+}
+
+// draws the visible lines of the window into the frame of canvas
+// starting at (offset_x, offset_y) that is width by height cells
 void Window_render(
-  Window *self,
+  Window *self, Canvas *canvas,
   uint16_t offset_x, uint16_t offset_y,
   uint16_t width, uint16_t height,
   bool focused
 ) {
-  if (self->window_start >= self->lines.item_count) { return; }
+  size_t view_count = Window_view_count(self);
+  if (self->window_start >= view_count) { return; }
+
+  // NOTE sized for the lines still being indexed so it does not keep widening
+  uint8_t line_number_max_digits = base_10_digits(Window_expected_line_count(self));
+  uint16_t end_col = offset_x + width;
+
+  CellStyle gutter_style = STYLE_DEFAULT;
+  if (focused) { gutter_style = STYLE_BACKGROUND(4); }
+  LinePin pin = LINE_PIN_NONE;
+  uint16_t gutter_col = offset_x + line_number_max_digits + 1;
+  uint16_t end_row = offset_y + height;
+  if (self->wrap) { Window_set_wrap_width(self, (end_col > gutter_col + 2) ? end_col - (gutter_col + 2) : 1); }
+
+  uint16_t row = offset_y;
+  for (size_t i = self->window_start; i < view_count && row < end_row; i += 1) {
+    // NOTE the gutter numbers the lines of the source, also while filtered
+    size_t number = Window_view_line(self, i);
+    char line_number[24];
+    int line_number_length = snprintf(line_number, sizeof(line_number), "%zu", number);
+    CellStyle line_number_style = STYLE_DEFAULT;
+    if (number == self->marked_line) { line_number_style.flags |= STYLE_REVERSE; }
+    Canvas_put_text(canvas, row, offset_x, end_col, line_number, line_number_length, line_number_style);
+    // NOTE the lines of a command's stderr get a red ! in the gutter
+    const char *gutter = "|";
+    CellStyle line_gutter_style = gutter_style;
+    if (Window_line_from_stderr(self, number)) {
+      gutter = "!";
+      line_gutter_style.fg = 1;
+      line_gutter_style.flags |= STYLE_FG_SET;
+    }
+    Canvas_put_text(canvas, row, gutter_col, end_col, gutter, 1, line_gutter_style);
+
+    LineView line = Window_get_line(self, number, &pin);
+    LineCache *cached = Window_cache_line(self, number, &line);
+    uint16_t text_col = gutter_col + 2;
+
+    if (self->wrap) {
+      size_t rows = Window_cache_rows(self, cached, line);
+      size_t line_row = 0, offset = 0;
+      if (i == self->window_start && self->row_start > 0) {
+        // NOTE the line may take fewer rows since the frame got wider
+        if (self->row_start >= rows) { self->row_start = rows - 1; }
+        line_row = self->row_start;
+        offset = Window_row_offset(self, cached, line, line_row);
+      }
+      while (true) {
+        size_t row_end = offset + text_wrap_row(line.data + offset, line.length - offset, self->wrap_width);
+        Window_put_text(canvas, row, text_col, end_col, cached, line, offset, row_end, 0);
+        offset = row_end;
+        row += 1;
+        line_row += 1;
+        if (line_row >= rows || row >= end_row) { break; }
+        Canvas_put_text(canvas, row, gutter_col, end_col, gutter, 1, line_gutter_style);
+      }
+      continue;
+    }
 
-  uint8_t line_number_max_digits = base_10_digits(self->lines.item_count);
+    // NOTE lines longer than the frame are cut off at the border, once a
+    // line is cached only the bytes of the columns that fit are looked at
+    size_t text_column = 0, text_offset = 0;
+    uint16_t line_row = row;
+    row += 1;
+    if (self->column_start > 0) {
+      text_offset = Window_skip_columns(self, cached, line, &text_column);
+      if (text_offset == line.length) { continue; }
+      // a wide character or tab straddling the left edge is left out
+      text_col += text_column - self->column_start;
+    }
+    Window_put_text(canvas, line_row, text_col, end_col, cached, line, text_offset, line.length, text_column);
+  }
+  Window_release_pin(self, &pin);
 
-  const char *COLOR;
+}
 
-  if (focused) {
-    COLOR = "\x1b[44m";
-  }else { COLOR = ""; }
+void Window_set_wrap(Window *self, bool wrap) {
+  self->wrap = wrap;
+  self->row_start = 0;
+}
 
+void Window_move_left(Window *self, size_t columns) {
+  self->column_start = (self->column_start < columns) ? 0 : self->column_start - columns;
+}
 
-  // TODO use snprintf to a buffer to clip the formatting result
-  for(
-    uint16_t i = self->window_start;
-    i < self->lines.item_count && (i - self->window_start) <= height;
-    i += 1
-  ) {
-    move_cursor_to_position(stdout, offset_y + (i - self->window_start), offset_x);
-    fprintf(stdout, "%u", i);
+void Window_move_right(Window *self, size_t columns) {
+  self->column_start += columns;
+}
+
+// the rows the line at index of the view takes when it is wrapped
+static size_t Window_line_rows(Window *self, size_t index, LinePin *pin) {
+  size_t number = Window_view_line(self, index);
+  LineView line = Window_get_line(self, number, pin);
+  LineCache *cached = Window_cache_line(self, number, &line);
+  return Window_cache_rows(self, cached, line);
+}
 
-    move_cursor_to_col(stdout, line_number_max_digits + 1 + offset_x);
-    fprintf(stdout, "%s|\x1b[0m %s", COLOR, self->lines.items[i]);
+// the rows of a whole block of lines, counted the first time it is asked for
+//
+// NOTE the lines of a block are counted without going through the line
+// cache, which is left to the lines on screen
+static size_t Window_block_rows(Window *self, size_t block, LinePin *pin) {
+  if (block >= self->wrap_block_capacity) {
+    size_t capacity = (self->wrap_block_capacity == 0) ? 64 : self->wrap_block_capacity;
+    while (capacity <= block) { capacity *= 2; }
+    self->wrap_blocks = realloc(self->wrap_blocks, capacity * sizeof(size_t));
+    for (size_t i = self->wrap_block_capacity; i < capacity; i += 1) { self->wrap_blocks[i] = 0; }
+    self->wrap_block_capacity = capacity;
   }
+  if (self->wrap_blocks[block] == 0) {
+    size_t rows = 0;
+    for (size_t i = block * WRAP_BLOCK_LINES; i < (block + 1) * WRAP_BLOCK_LINES; i += 1) {
+      LineView line = Window_get_line(self, Window_view_line(self, i), pin);
+      if (sgr_parse(line.data, line.length, &self->wrap_scratch)) {
+        line = (LineView){ .data = self->wrap_scratch.text, .length = self->wrap_scratch.length };
+      }
+      rows += text_rows(line.data, line.length, self->wrap_width);
+    }
+    self->wrap_blocks[block] = rows;
+  }
+  return self->wrap_blocks[block];
+}
+
+// where the frame starts when it shows the last page of a frame height
+// rows tall, at row row of line line
+void Window_last_page(Window *self, size_t height, size_t *line, size_t *row) {
+  size_t line_count = Window_view_count(self);
+  *row = 0;
+  if (!self->wrap) {
+    *line = (line_count > height) ? line_count - height : 0;
+    return;
+  }
+  LinePin pin = LINE_PIN_NONE;
+  size_t needed = (height > 0) ? height : 1;
+  *line = line_count;
+  while (*line > 0) {
+    size_t rows = Window_line_rows(self, *line - 1, &pin);
+    *line -= 1;
+    if (rows >= needed) {
+      *row = rows - needed;
+      break;
+    }
+    needed -= rows;
+  }
+  Window_release_pin(self, &pin);
+}
+
+static bool position_after(size_t line, size_t row, size_t other_line, size_t other_row) {
+  return line > other_line || (line == other_line && row > other_row);
+}
 
+// whether the frame shows the last page (or past it)
+bool Window_on_last_page(Window *self, size_t height) {
+  size_t last_line, last_row;
+  Window_last_page(self, height, &last_line, &last_row);
+  return !position_after(last_line, last_row, self->window_start, self->row_start);
+}
+
+// moves to line, or to the last page if line is on it
+void Window_move_to(Window *self, size_t line, size_t height) {
+  size_t last_line, last_row;
+  Window_last_page(self, height, &last_line, &last_row);
+  if (position_after(line, 0, last_line, last_row)) {
+    self->window_start = last_line;
+    self->row_start = last_row;
+  }else {
+    self->window_start = line;
+    self->row_start = 0;
+  }
 }
 
 void Window_move_up(Window *self, size_t count) {
-  if (self->window_start < count) { self->window_start = 0; }
-  else { self->window_start -= count; }
+  self->stick_to_bottom = false;
+  if (!self->wrap) {
+    if (self->window_start < count) { self->window_start = 0; }
+    else { self->window_start -= count; }
+    return;
+  }
+
+  LinePin pin = LINE_PIN_NONE;
+  size_t line = self->window_start, row = self->row_start;
+  while (count > 0) {
+    if (row >= count) {
+      row -= count;
+      break;
+    }
+    count -= row;
+    row = 0;
+    if (line == 0) { break; }
+    // whole blocks above are passed over by their totals
+    if (line % WRAP_BLOCK_LINES == 0 && count >= WRAP_BLOCK_LINES) {
+      size_t block_rows = Window_block_rows(self, line / WRAP_BLOCK_LINES - 1, &pin);
+      if (block_rows <= count) {
+        count -= block_rows;
+        line -= WRAP_BLOCK_LINES;
+        continue;
+      }
+    }
+    line -= 1;
+    row = Window_line_rows(self, line, &pin);
+  }
+  Window_release_pin(self, &pin);
+  self->window_start = line;
+  self->row_start = row;
+}
+
+void Window_move_down(Window *self, size_t count, size_t height) {
+  size_t last_line, last_row;
+  Window_last_page(self, height, &last_line, &last_row);
+  if (!self->wrap) {
+    if (self->window_start >= last_line) { return; }
+    if (last_line - self->window_start < count) {
+      self->window_start = last_line;
+    } else { self->window_start += count; }
+    return;
+  }
+
+  LinePin pin = LINE_PIN_NONE;
+  size_t line = self->window_start, row = self->row_start;
+  size_t line_count = Window_view_count(self);
+  while (count > 0 && position_after(last_line, last_row, line, row)) {
+    // whole blocks below are passed over by their totals, a block of
+    // lines takes at least as many rows as it has lines
+    if (
+      row == 0 && line % WRAP_BLOCK_LINES == 0 &&
+      count >= WRAP_BLOCK_LINES && line + WRAP_BLOCK_LINES <= line_count
+    ) {
+      size_t block_rows = Window_block_rows(self, line / WRAP_BLOCK_LINES, &pin);
+      if (block_rows <= count) {
+        count -= block_rows;
+        line += WRAP_BLOCK_LINES;
+        continue;
+      }
+    }
+    size_t rows = Window_line_rows(self, line, &pin);
+    if (row + count < rows) {
+      row += count;
+      count = 0;
+    }else {
+      count -= rows - row;
+      line += 1;
+      row = 0;
+    }
+  }
+  Window_release_pin(self, &pin);
+  if (position_after(line, row, last_line, last_row)) {
+    line = last_line;
+    row = last_row;
+  }
+  self->window_start = line;
+  self->row_start = row;
+}
+
+// the rows between two positions of the frame, negative when to is above
+// from, or limit rows (negated) if they are at least that far apart
+int64_t Window_row_distance(
+  Window *self, size_t from_line, size_t from_row, size_t to_line, size_t to_row, int64_t limit
+) {
+  if (!self->wrap) {
+    int64_t distance = (int64_t)to_line - (int64_t)from_line;
+    if (distance >= limit) { return limit; }
+    return (distance <= -limit) ? -limit : distance;
+  }
+  int64_t sign = 1;
+  if (position_after(from_line, from_row, to_line, to_row)) {
+    size_t line = from_line, row = from_row;
+    from_line = to_line;
+    from_row = to_row;
+    to_line = line;
+    to_row = row;
+    sign = -1;
+  }
+  LinePin pin = LINE_PIN_NONE;
+  int64_t distance = -(int64_t)from_row;
+  for (size_t line = from_line; line < to_line && distance < limit; line += 1) {
+    distance += Window_line_rows(self, line, &pin);
+  }
+  Window_release_pin(self, &pin);
+  distance += to_row;
+  return sign * ((distance < limit) ? distance : limit);
+}
+
+// the first line that ends at or after offset, or the last line
+size_t Window_line_at_offset(Window *self, size_t offset) {
+  size_t low = 0, high = Window_line_count(self);
+  if (high == 0) { return 0; }
+  while (low < high) {
+    size_t middle = low + (high - low) / 2;
+    if (SpscList_at(self->line_ends, middle) < offset) { low = middle + 1; }else { high = middle; }
+  }
+  return (low < Window_line_count(self)) ? low : low - 1;
+}
+
+
+
+void Screen_set_status(Screen *self, const char *message) {
+  snprintf(self->status, sizeof(self->status), "%s", message);
+  self->needs_redraw = true;
+}
+
+// the frame of the focused window, or the first frame while the focused
+// window has nothing to show, NULL before any window has
+Frame *Screen_focused_frame(Screen *self) {
+  if (self->shown_count == 0) { return NULL; }
+  for (uint8_t i = 0; i < self->shown_count; i += 1) {
+    if (self->frames[i].source == &self->windows.items[self->focus]) { return &self->frames[i]; }
+  }
+  return &self->frames[0];
+}
+
+Window *Screen_focused_window(Screen *self) {
+  Frame *frame = Screen_focused_frame(self);
+  return (frame == NULL) ? NULL : frame->source;
 }
 
-void Window_move_down(Window *self, size_t count) {
-  if (self->lines.item_count - self->window_start < count) {
-    self->window_start = self->lines.item_count;
-  } else { self->window_start += count; }
+void Screen_mark_dirty(Screen *self, Window *window) {
+  for (uint8_t i = 0; i < self->shown_count; i += 1) {
+    if (self->frames[i].source == window) { self->frames[i].dirty = true; }
+  }
+  self->needs_redraw = true;
 }
 
+// moves the focused window, the jump lands when the screen is next drawn
+// or, if the window's index has not reached its target yet, once it has
+void Screen_jump(Screen *self, WindowJump jump) {
+  Window *window = Screen_focused_window(self);
+  if (window == NULL) { return; }
+  window->jump = jump;
+  Screen_mark_dirty(self, window);
+}
 
+void Screen_jump_to_percent(Screen *self, size_t percent) {
+  Window *window = Screen_focused_window(self);
+  if (window == NULL) { return; }
+  if (percent > 100) { percent = 100; }
+  if (window->source_type == WINDOW_SOURCE_FILE) {
+    // NOTE like less, a percentage of a file is of its bytes, so where it
+    // lands is known before the whole file has been indexed
+    struct stat file_stat;
+    size_t file_size = (fstat(window->source_fd, &file_stat) == 0) ? file_stat.st_size : 0;
+    size_t target = file_size / 100 * percent + file_size % 100 * percent / 100;
+    Screen_jump(self, (WindowJump){ .type = WINDOW_JUMP_BYTE, .target = target });
+  }else {
+    // a stream is a percentage of what has been read so far
+    size_t line_count = Window_line_count(window);
+    size_t target = line_count / 100 * percent + line_count % 100 * percent / 100;
+    if (target >= line_count && line_count > 0) { target = line_count - 1; }
+    Screen_jump(self, (WindowJump){ .type = WINDOW_JUMP_LINE, .target = target });
+  }
+}
 
-// WindowControl Window_handle_input(Window *self, uint16_t window_height, bool *needs_redraw) {
-WindowControl Screen_handle_input(Screen *self) {
-  // Window *acting_window = &self->windows.items[self->focus];
-  Frame current_frame = (self->focus == self->top_window) ? self->top : self->bottom;
+// starts looking for pattern in the focused window from the line after
+// (or before) the top line of its frame, or for its nth match when nth is set
+void Screen_start_search(Screen *self, const char *pattern, size_t pattern_length, SearchDirection direction, size_t nth) {
+  Window *window = Screen_focused_window(self);
+  if (window == NULL || pattern_length == 0) { return; }
 
-  KeyboardCode buffer = (KeyboardCode){ .integer = 0x0 };
-  size_t read_size = read(fileno(stdin), buffer.buffer, 4);
-  if (read_size != 0) {
-    switch(buffer.integer) {
-      case WINDOW_MOVE_UP: Window_move_up(current_frame.source, 1); self->needs_redraw = true; break;
-      case WINDOW_PAGE_UP: {
-        Window_move_up(current_frame.source, current_frame.height);
-        self->needs_redraw = true;
-      } break;
-      case WINDOW_MOVE_DOWN: Window_move_down(current_frame.source, 1); self->needs_redraw = true; break;
-      case WINDOW_PAGE_DOWN: {
-        Window_move_down(current_frame.source, current_frame.height);
-        self->needs_redraw = true;
-      } break;
-      case WINDOW_QUIT: return WINDOW_QUIT;
-      case WINDOW_SWITCH_NEXT: self->needs_redraw = true; return WINDOW_SWITCH_NEXT;
-      case WINDOW_SWITCH_PREV: self->needs_redraw = true; return WINDOW_SWITCH_PREV;
-      default: return WINDOW_CONTROL_NONE;
+  if (nth > 0) {
+    Search_start(self->search, window, pattern, pattern_length, SEARCH_REQUEST_NTH, direction, 0, nth);
+  }else {
+    // NOTE the search runs over every line, a filtered window starts from the line at its top
+    size_t top = (Window_view_count(window) > 0) ? Window_view_line(window, window->window_start) : 0;
+    if (direction == SEARCH_BACKWARD && top == 0) {
+      Screen_set_status(self, "Pattern not found");
+      return;
     }
+    size_t from_line = (direction == SEARCH_FORWARD) ? top + 1 : top - 1;
+    Search_start(self->search, window, pattern, pattern_length, SEARCH_REQUEST_NEXT, direction, from_line, 0);
+  }
+  Screen_set_status(self, "searching... (any key cancels)");
+  Screen_handle_search_wake(self);
+}
+
+// shows where the marked match sits among the matches, once they are all indexed
+void Screen_report_match_position(Screen *self, Window *window, size_t line) {
+  if (!Search_is_complete(self->search)) { return; }
+  snprintf(self->status, sizeof(self->status), "match %zu of %zu",
+    Search_matches_through(self->search, window, line),
+    Search_window_match_count(self->search, window)
+  );
+}
+
+void Screen_handle_search_wake(Screen *self) {
+  Search *search = self->search;
+  int64_t result = Search_poll(search);
+  self->needs_redraw = true;
+
+  if (result == SEARCH_PENDING) {
+    snprintf(self->status, sizeof(self->status), "searching... %zu lines (any key cancels)",
+      atomic_load(&search->lines_scanned)
+    );
+    return;
+  }
+  if (result == SEARCH_CANCELED) { return; }
+
+  Window *window = search->windows[search->target].window;
+  if (search->result_delivered) {
+    // the rest of the index finished after the answer was shown
+    if (!search->running && window->marked_line != SIZE_MAX && search->request != SEARCH_REQUEST_COUNT) {
+      Screen_report_match_position(self, window, window->marked_line);
+    }
+    return;
+  }
+  search->result_delivered = true;
+
+  if (search->error != NULL) {
+    snprintf(self->status, sizeof(self->status), "Invalid pattern: %s", search->error);
+  }else if (search->request == SEARCH_REQUEST_COUNT) {
+    snprintf(self->status, sizeof(self->status), "%zu matches (%zu in all windows)",
+      Search_window_match_count(search, window), Search_total_match_count(search)
+    );
+  }else if (result == SEARCH_NOT_FOUND) {
+    snprintf(self->status, sizeof(self->status), "Pattern not found");
+  }else if (window->filter != NULL) {
+    // the match is only shown if it passes the filter, otherwise the
+    // window lands on the next line that does
+    window->jump = (WindowJump){ .type = WINDOW_JUMP_LINE, .target = result };
+    window->marked_line = result;
+    Screen_mark_dirty(self, window);
+    window->stick_to_bottom = false;
+    self->status[0] = '\0';
+    Screen_report_match_position(self, window, result);
+  }else {
+    window->window_start = result;
+    window->row_start = 0;
+    window->marked_line = result;
+    Screen_mark_dirty(self, window);
+    window->stick_to_bottom = false;
+    self->status[0] = '\0';
+    Screen_report_match_position(self, window, result);
+  }
+}
+
+void Screen_reopen_window(Screen *self, Window *window) {
+  // the search and the filter may be scanning the mapping that is about to
+  // go away, the filter starts over on the reopened file
+  Search_forget_window(self->search, window);
+  char pattern[SEARCH_PATTERN_MAX];
+  size_t pattern_length = 0;
+  if (window->filter != NULL) {
+    pattern_length = window->filter->pattern_length;
+    memcpy(pattern, window->filter->pattern, pattern_length);
+    Window_set_filter(window, NULL, 0);
+  }
+  Window_reopen(window);
+  if (pattern_length > 0) { Window_set_filter(window, pattern, pattern_length); }
+  window->stick_to_bottom = true;
+  Screen_mark_dirty(self, window);
+  Screen_set_status(self, "file was truncated or replaced, reopened it");
+}
+
+// jumps to the line number typed after :, or to a percentage if it ends in %
+void Screen_goto_prompt(Screen *self) {
+  size_t number = 0;
+  size_t digits = 0;
+  while (digits < self->prompt_length && self->prompt[digits] >= '0' && self->prompt[digits] <= '9') {
+    if (number > (SIZE_MAX - 9) / 10) { number = SIZE_MAX; }
+    else { number = number * 10 + (self->prompt[digits] - '0'); }
+    digits += 1;
+  }
+  bool percent = digits + 1 == self->prompt_length && self->prompt[digits] == '%';
+  if (digits == 0 || (digits != self->prompt_length && !percent)) {
+    Screen_set_status(self, "Invalid line number");
+    return;
+  }
+  if (percent) { Screen_jump_to_percent(self, number); }
+  else { Screen_jump(self, (WindowJump){ .type = WINDOW_JUMP_LINE, .target = number }); }
+}
+
+// filters the focused window by the pattern typed after &, or shows all of
+// its lines again if none was
+void Screen_filter_prompt(Screen *self) {
+  Window *window = Screen_focused_window(self);
+  if (window == NULL) { return; }
+  const char *error = Window_set_filter(window, self->prompt, self->prompt_length);
+  Screen_mark_dirty(self, window);
+  if (error != NULL) {
+    snprintf(self->status, sizeof(self->status), "Invalid pattern: %s", error);
+  }else if (self->prompt_length == 0) {
+    Screen_set_status(self, "showing all lines");
+  }
+}
+
+// edits the prompt, enter starts the search (or the jump) and escape abandons it
+void Screen_handle_prompt_key(Screen *self, KeyboardCode key) {
+  self->needs_redraw = true;
+  char byte = key.buffer[0];
+  if (byte == '\r' || byte == '\n') {
+    InputMode mode = self->input_mode;
+    self->input_mode = INPUT_NORMAL;
+    if (mode == INPUT_GOTO_LINE) {
+      Screen_goto_prompt(self);
+    }else if (mode == INPUT_FILTER) {
+      Screen_filter_prompt(self);
+    }else {
+      Screen_start_search(
+        self, self->prompt, self->prompt_length,
+        self->prompt_backward ? SEARCH_BACKWARD : SEARCH_FORWARD, 0
+      );
+    }
+  }
+  else if (byte == 0x1b && key.buffer[1] == '\0') { self->input_mode = INPUT_NORMAL; }
+  else if (byte == 0x7f || byte == 0x08) {
+    // NOTE an empty filter prompt stays open, enter on it drops the filter
+    if (self->prompt_length == 0) {
+      if (self->input_mode != INPUT_FILTER) { self->input_mode = INPUT_NORMAL; }
+    }else { self->prompt_length -= 1; }
+  }
+  else if ((uint8_t)byte >= 0x20 && key.buffer[1] == '\0' && self->prompt_length < SCREEN_PROMPT_MAX) {
+    self->prompt[self->prompt_length] = byte;
+    self->prompt_length += 1;
+  }
+}
+
+// handles a single key press, returning what the Screen should do about it
+WindowControl Screen_handle_key(Screen *self, KeyboardCode key) {
+  Frame *frame = Screen_focused_frame(self);
+
+  // any key stops a search that is still looking for its answer
+  if (Search_is_waiting(self->search)) {
+    Search_cancel(self->search);
+    Screen_set_status(self, "search canceled");
+    return WINDOW_CONTROL_NONE;
+  }
+  // and a jump that is still waiting for the index
+  Window *focused_window = Screen_focused_window(self);
+  if (self->jump_waiting && focused_window != NULL && focused_window->jump.type != WINDOW_JUMP_NONE) {
+    focused_window->jump.type = WINDOW_JUMP_NONE;
+    self->jump_waiting = false;
+    Screen_set_status(self, "jump canceled");
+    return WINDOW_CONTROL_NONE;
+  }
+  if (self->input_mode != INPUT_NORMAL) {
+    Screen_handle_prompt_key(self, key);
+    return WINDOW_CONTROL_NONE;
+  }
+  if (self->status[0] != '\0') {
+    self->status[0] = '\0';
+    self->needs_redraw = true;
+  }
+
+  if (key.integer >= '0' && key.integer <= '9') {
+    self->count = self->count * 10 + (key.integer - '0');
+    return WINDOW_CONTROL_NONE;
+  }
+  size_t count = self->count;
+  self->count = 0;
+  // movements are repeated count times
+  size_t repeat = (count > 0) ? count : 1;
+
+  switch(key.integer) {
+    case WINDOW_MOVE_UP:
+    case WINDOW_PAGE_UP: {
+      if (frame == NULL) { break; }
+      Window_move_up(frame->source, (key.integer == WINDOW_MOVE_UP) ? repeat : repeat * frame->height);
+      Screen_mark_dirty(self, frame->source);
+    } break;
+    case WINDOW_MOVE_DOWN:
+    case WINDOW_PAGE_DOWN: {
+      if (frame == NULL) { break; }
+      size_t rows = (key.integer == WINDOW_MOVE_DOWN) ? repeat : repeat * frame->height;
+      Window_move_down(frame->source, rows, frame->height);
+      Screen_mark_dirty(self, frame->source);
+    } break;
+    case WINDOW_TOP:
+    case WINDOW_HOME:
+    case WINDOW_BOTTOM:
+    case WINDOW_END: {
+      // g goes to the first line and G to the last, with a count both go to line count
+      bool top = key.integer == WINDOW_TOP || key.integer == WINDOW_HOME;
+      size_t target = (count > 0) ? count : (top ? 0 : SIZE_MAX);
+      Screen_jump(self, (WindowJump){ .type = WINDOW_JUMP_LINE, .target = target });
+    } break;
+    case WINDOW_WRAP: {
+      if (frame == NULL) { break; }
+      Window_set_wrap(frame->source, !frame->source->wrap);
+      Screen_mark_dirty(self, frame->source);
+      Screen_set_status(self, frame->source->wrap ? "wrapping long lines" : "cutting off long lines");
+    } break;
+    case WINDOW_SCROLL_LEFT:
+    case WINDOW_SCROLL_RIGHT: {
+      // NOTE there is nothing to the side of wrapped lines
+      if (frame == NULL || frame->source->wrap) { break; }
+      // by half of the frame at a time like less does
+      size_t columns = repeat * ((frame->width > 1) ? frame->width / 2 : 1);
+      if (key.integer == WINDOW_SCROLL_LEFT) { Window_move_left(frame->source, columns); }
+      else { Window_move_right(frame->source, columns); }
+      Screen_mark_dirty(self, frame->source);
+    } break;
+    case WINDOW_VERTICAL: {
+      self->vertical = !self->vertical;
+      self->redraw_all = true;
+      self->needs_redraw = true;
+      Screen_set_status(self, self->vertical ? "frames side by side" : "frames stacked");
+    } break;
+    case WINDOW_GOTO_PERCENT: Screen_jump_to_percent(self, count); break;
+    case WINDOW_GOTO_LINE: {
+      self->input_mode = INPUT_GOTO_LINE;
+      self->prompt_length = 0;
+      self->needs_redraw = true;
+    } break;
+    case WINDOW_FILTER: {
+      self->input_mode = INPUT_FILTER;
+      self->prompt_length = 0;
+      self->needs_redraw = true;
+    } break;
+    case WINDOW_QUIT: return WINDOW_QUIT;
+    case WINDOW_SWITCH_NEXT: self->needs_redraw = true; return WINDOW_SWITCH_NEXT;
+    case WINDOW_SWITCH_PREV: self->needs_redraw = true; return WINDOW_SWITCH_PREV;
+    case WINDOW_SEARCH_FORWARD:
+    case WINDOW_SEARCH_BACKWARD: {
+      self->input_mode = INPUT_PROMPT;
+      self->prompt_backward = key.integer == WINDOW_SEARCH_BACKWARD;
+      self->prompt_length = 0;
+      self->needs_redraw = true;
+    } break;
+    case WINDOW_SEARCH_NEXT:
+    case WINDOW_SEARCH_PREV: {
+      // n repeats the last search in its direction, N in the other one
+      bool backward = self->prompt_backward != (key.integer == WINDOW_SEARCH_PREV);
+      Screen_start_search(
+        self, self->search->pattern, self->search->pattern_length,
+        backward ? SEARCH_BACKWARD : SEARCH_FORWARD, count
+      );
+    } break;
+    case WINDOW_FOLLOW: {
+      Window *window = Screen_focused_window(self);
+      if (window == NULL) { break; }
+      Window_set_following(window, !atomic_load(&window->following));
+      Screen_set_status(self, atomic_load(&window->following)
+        ? "following, scroll up to stop sticking to the end (F stops)"
+        : "stopped following"
+      );
+    } break;
+    case WINDOW_SEARCH_COUNT: {
+      Window *window = Screen_focused_window(self);
+      if (window == NULL || self->search->pattern_length == 0) { break; }
+      Search_start(
+        self->search, window, self->search->pattern, self->search->pattern_length,
+        SEARCH_REQUEST_COUNT, SEARCH_FORWARD, 0, 0
+      );
+      Screen_set_status(self, "counting... (any key cancels)");
+      Screen_handle_search_wake(self);
+    } break;
+    default: return WINDOW_CONTROL_NONE;
   }
   return WINDOW_CONTROL_NONE;
-} 
+}
+
+// returns the length of the key press at the start of input, escape
+// sequences (ESC [ params final) count as one key
+size_t key_length(const char *input, size_t available) {
+  if (input[0] != 0x1b || available < 2 || input[1] != '[') { return 1; }
+  size_t length = 2;
+  while (length < available && (input[length] < 0x40 || input[length] > 0x7e)) { length += 1; }
+  if (length < available) { length += 1; }
+  return length;
+}
 
 void Window_free(Window *self) {
-  List_foreach(CharString, self->lines, {
-    free(*item);
-  });
-  List_CharString_free(&self->lines);
+  if (self->filter != NULL) { Filter_free(self->filter); }
+  close(self->wake_fd);
+  for (size_t i = 0; i < WINDOW_LINE_CACHE_SIZE; i += 1) { StyledText_free(&self->line_cache[i].text); }
+  free(self->line_cache);
+  free(self->wrap_blocks);
+  StyledText_free(&self->wrap_scratch);
+  if (self->source_type == WINDOW_SOURCE_FILE) {
+    if (self->file_map != NULL) {
+      unregister_file_map(self->file_map);
+      munmap((void *)self->file_map, self->file_map_reserved);
+    }
+    close(self->follow_fd);
+    SpscList_size_t_free(&self->line_ends);
+  }else if (self->source_type == WINDOW_SOURCE_MERGED) {
+    Merge_free(self->merge);
+  }else {
+    LineStore_free(&self->store);
+    SpscList_LineStamp_free(&self->stamps);
+  }
+}
 
-  pthread_mutex_lock(&self->new_lines_mutex);
-  List_foreach(CharString, self->new_lines, {
-    free(*item);
-  });
-  List_CharString_free(&self->new_lines);
+size_t truncation_page_size;
+
+void handle_truncated_map(int signal_number, siginfo_t *info, void *context) {
+  uintptr_t address = (uintptr_t)info->si_addr;
+  uintptr_t page = address & ~(uintptr_t)(truncation_page_size - 1);
+  void *zeroes = MAP_FAILED;
+  if (info->si_code == BUS_ADRERR && in_file_map(address)) {
+    zeroes = mmap((void *)page, truncation_page_size, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0);
+  }
+  // anything else is a real fault, it gets the default action when the access repeats
+  if (zeroes == MAP_FAILED) {
+    struct sigaction action = { .sa_handler = SIG_DFL };
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGBUS, &action, NULL);
+  }
 }
 
+void install_truncation_handler() {
+  truncation_page_size = sysconf(_SC_PAGESIZE);
+  struct sigaction action = { .sa_sigaction = handle_truncated_map, .sa_flags = SA_SIGINFO };
+  sigemptyset(&action.sa_mask);
+  sigaction(SIGBUS, &action, NULL);
+}
+
+// the fewest columns and rows a frame is given before the layout tree
+// starts another column (or row) of frames instead
+#define LAYOUT_MIN_FRAME_WIDTH 24
+#define LAYOUT_MIN_FRAME_HEIGHT 4
+
+// a leaf of the layout tree, the area of one frame
 typedef struct {
-  Window *source;
-  uint16_t offset_x, offset_y, width, height;
+  uint8_t frame;
 } LayoutSlaveWindow;
 
+// an inner node of the layout tree, its area is divided evenly between
+// its children (blocks first_child on) side by side when it is vertical
+// or stacked when it is not, with a one cell divider between each two
 typedef struct {
-  LayoutSlaveWindow *source, split;
-  uint16_t offset_x, offset_y, width, height;
+  bool vertical;
+  uint16_t first_child, child_count;
 } LayoutMaster;
 
 typedef union {
@@ -319,166 +1660,411 @@ typedef enum {
   LAYOUT_SLAVE_WINDOW,
 } LayoutType;
 
-typedef struct {
+struct LayoutBlock {
   LayoutUnion block;
   LayoutType type;
-} LayoutBlock;
+  uint16_t offset_x, offset_y, width, height;
+};
 
 
 typedef struct winsize TTY_Dims;
 
-InterfaceCommand Screen_read_stdin( Screen *self ) {
-  // Window *focused_window = &self->windows.items[self->focus];
-  TTY_Dims tty_dims;
-  ioctl(STDOUT_FILENO, TIOCGWINSZ, &tty_dims);
-  WindowControl code = Screen_handle_input(self);
-  if (code == WINDOW_QUIT) { return INTERFACE_RESULT_QUIT; }
-  else if (code == WINDOW_SWITCH_NEXT) {
+// hidden windows (the sources of a merged one) and empty ones have no frame
+static bool Screen_can_focus(Screen *self, size_t index) {
+  Window *window = &self->windows.items[index];
+  return !window->hidden && Window_line_count(window) > 0;
+}
+
+void Screen_switch_focus(Screen *self, WindowControl code) {
+  if (code == WINDOW_SWITCH_NEXT) {
     self->focus += 1;
     for (uint16_t i = self->focus; i < self->windows.item_count; i += 1) {
-      if (self->windows.items[i].lines.item_count > 0) {
+      if (Screen_can_focus(self, i)) {
         self->focus = i;
-        return INTERFACE_RESULT_NONE;
+        return;
       }
     }
     for (uint16_t i = 0; i < self->focus; i += 1) {
-      if (self->windows.items[i].lines.item_count > 0) {
+      if (Screen_can_focus(self, i)) {
         self->focus = i;
-        return INTERFACE_RESULT_NONE;
+        return;
       }
     }
     self->focus -= 1;
   }
   else if (code == WINDOW_SWITCH_PREV) {
     if (self->focus == 0) { self->focus = self->windows.item_count; }
-    // else { self->focus -= 1; }
     self->focus -= 1;
     for (int16_t i = self->focus; i >= 0; i -= 1) {
-      if (self->windows.items[i].lines.item_count > 0) {
+      if (Screen_can_focus(self, i)) {
         self->focus = i;
-        return INTERFACE_RESULT_NONE;
+        return;
       }
     }
     for (uint16_t i = self->windows.item_count - 1; i > self->focus; i -= 1) {
-      if (self->windows.items[i].lines.item_count > 0) {
+      if (Screen_can_focus(self, i)) {
         self->focus = i;
-        return INTERFACE_RESULT_NONE;
+        return;
       }
     }
     self->focus += 1;
   }
+}
+
+InterfaceCommand Screen_read_stdin( Screen *self ) {
+  // NOTE a held key (or a slow link) can deliver several keys in one read,
+  // they are all applied before the next frame is drawn
+  char input[64];
+  ssize_t read_size = read(fileno(stdin), input, sizeof(input));
+  size_t offset = 0;
+  while (read_size > 0 && offset < (size_t)read_size) {
+    size_t length = key_length(input + offset, read_size - offset);
+    KeyboardCode key = (KeyboardCode){ .integer = 0x0 };
+    // sequences that do not fit are not keys we know about
+    if (length <= sizeof(key.buffer)) { memcpy(key.buffer, input + offset, length); }
+    offset += length;
+
+    WindowControl code = Screen_handle_key(self, key);
+    if (code == WINDOW_QUIT) { return INTERFACE_RESULT_QUIT; }
+    // the gutters of both frames show which one has the focus
+    Window *focused = Screen_focused_window(self);
+    Screen_switch_focus(self, code);
+    if (Screen_focused_window(self) != focused) {
+      Screen_mark_dirty(self, focused);
+      Screen_mark_dirty(self, Screen_focused_window(self));
+    }
+  }
   return INTERFACE_RESULT_NONE;
 }
 
-typedef struct {
-  uint16_t a, b;
-} uint16x2;
-
-uint16x2 calculate_window_dims(TTY_Dims dims) {
-  uint16_t floor_win_height = (uint16_t)dims.ws_row >> 1;
-  if ((uint16_t)dims.ws_row & 0b0000000000000001) {
-    // odd number of rows
-    return (uint16x2){ .a = floor_win_height + 1, .b = floor_win_height };
-  }else {
-    return (uint16x2){ .a = floor_win_height, .b = floor_win_height };
+// hands the composed frame to the terminal in one write
+void Screen_flush(Screen *self) {
+  OutputBuffer_flush(&self->output, STDOUT_FILENO);
+  self->frame_count += 1;
+  self->total_frame_bytes += self->output.flushed_bytes;
+  self->total_frame_syscalls += self->output.flush_syscalls;
+  if (self->report_frame_stats) {
+    fprintf(stderr, "STATS: frame %zu bytes %zu syscalls %zu\n",
+      self->frame_count, self->output.flushed_bytes, self->output.flush_syscalls
+    );
   }
 }
 
-typedef struct {
-  Window *source;
-  uint16_t offset_x, offset_y, width, height;
-} WindowContext;
+// scrolls the rows of the frame that are still visible since the last render
+// in place on the terminal, so only the newly exposed rows need to be drawn
+void Frame_scroll_terminal(Frame *self, Canvas *front, OutputBuffer *out) {
+  Window *window = self->source;
+  bool same_layout = window == self->rendered_source
+    && self->offset_y == self->rendered_offset_y
+    && self->height == self->rendered_height
+    && window->wrap == self->rendered_wrap;
+  if (same_layout && (window->window_start != self->rendered_start || window->row_start != self->rendered_row)) {
+    int64_t amount = Window_row_distance(
+      window, self->rendered_start, self->rendered_row, window->window_start, window->row_start, self->height
+    );
+    if (amount < self->height && -amount < self->height) {
+      // NOTE the region spans the whole width of the terminal, the borders
+      // on either side are the same on every row so they scroll for free
+      Canvas_scroll(front, out, self->offset_y, self->offset_y + self->height - 1, amount);
+    }
+  }
+  self->rendered_source = window;
+  self->rendered_start = window->window_start;
+  self->rendered_row = window->row_start;
+  self->rendered_wrap = window->wrap;
+  self->rendered_offset_y = self->offset_y;
+  self->rendered_height = self->height;
+}
 
-typedef struct {
-  WindowContext top;
-  WindowContext bot;
-} Layout;
+// lands the jump of the frame's window once its index has reached the
+// target, returns whether the jump is still waiting
+bool Frame_land_jump(Frame *self) {
+  Window *window = self->source;
+  WindowJump jump = window->jump;
+  if (jump.type == WINDOW_JUMP_NONE) { return false; }
+
+  size_t line_count = Window_line_count(window);
+  bool indexed = window->fully_indexed;
+  size_t line = jump.target;
+  if (jump.type == WINDOW_JUMP_LINE) {
+    if (line >= line_count && !indexed) { return true; }
+  }else {
+    bool reached = line_count > 0 && SpscList_at(window->line_ends, line_count - 1) >= jump.target;
+    if (!reached && !indexed) { return true; }
+    line = Window_line_at_offset(window, jump.target);
+  }
+  // a filtered window lands on the first match at or after the line,
+  // once its filter has got that far
+  Filter *filter = window->filter;
+  if (filter != NULL && filter->scanned_count <= line && filter->scanned_count < line_count) { return true; }
+  window->jump.type = WINDOW_JUMP_NONE;
+
+  // the target goes at the top unless it is on the last page
+  Window_move_to(window, Window_view_index(window, line), self->height);
+  window->stick_to_bottom = false;
+  return false;
+}
 
-bool Layout_is_empty(Layout *self) {
-  return self->top.source == NULL && self->bot.source == NULL;
+// shows how much of a file is indexed on the border above the frame
+// until all of it is, and then the pattern of a filtered window
+void Frame_render_progress(Frame *self, Canvas *canvas) {
+  Window *window = self->source;
+  char progress[SEARCH_PATTERN_MAX + 64];
+  int length = 0;
+  if (window->source_type == WINDOW_SOURCE_FILE && !window->fully_indexed && window->index_size != 0) {
+    size_t indexed_bytes = atomic_load(&window->indexed_bytes);
+    if (indexed_bytes > window->index_size) { indexed_bytes = window->index_size; }
+    length = snprintf(progress, sizeof(progress), " indexing %zu%% ",
+      (size_t)((double)indexed_bytes / window->index_size * 100)
+    );
+  }else if (window->filter != NULL) {
+    Filter *filter = window->filter;
+    size_t line_count = Window_line_count(window);
+    if (filter->scanned_count < line_count) {
+      length = snprintf(progress, sizeof(progress), " &%.*s filtering %zu%% ",
+        (int)filter->pattern_length, filter->pattern, (size_t)((double)filter->scanned_count / line_count * 100)
+      );
+    }else {
+      length = snprintf(progress, sizeof(progress), " &%.*s %zu lines ",
+        (int)filter->pattern_length, filter->pattern, filter->match_count
+      );
+    }
+  }
+  uint16_t end_col = self->offset_x + self->width;
+  if (length <= 0 || length >= self->width) { return; }
+  Canvas_put_text(canvas, self->offset_y - 1, end_col - length, end_col, progress, length, STYLE_DEFAULT);
 }
 
-bool Layout_is_split(Layout *self) {
-  if (Layout_is_empty(self)) { return false; }
-  if (self->top.source == NULL && self->bot.source != NULL) {
-    self->top.source = self->bot.source;
-    self->bot.source = NULL;
-    return false;
-  }else if (self->top.source != NULL && self->top.source == NULL) {
-    return false;
+// keeps the last lines of a followed window in view until the user scrolls
+// up, scrolling back down to the end makes it stick again
+void Frame_follow(Frame *self) {
+  Window *window = self->source;
+  if (!atomic_load(&window->following)) { return; }
+  if (Window_on_last_page(window, self->height)) { window->stick_to_bottom = true; }
+  if (window->stick_to_bottom) { Window_move_to(window, SIZE_MAX, self->height); }
+}
+
+bool Screen_resize(Screen *self) {
+  TTY_Dims tty_dims;
+  if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &tty_dims) < 0) {
+    fprintf(stderr, "WARN: failed to get the terminal size -> %s\n", strerror(errno));
+    if (self->rows != 0) { return false; }
+    tty_dims = (TTY_Dims){ .ws_row = 24, .ws_col = 80 };
   }
+  if (tty_dims.ws_row == self->rows && tty_dims.ws_col == self->cols) { return false; }
+  self->rows = tty_dims.ws_row;
+  self->cols = tty_dims.ws_col;
+  self->redraw_all = true;
   return true;
 }
 
-void Screen_render(Screen *self) {
-  TTY_Dims tty_dims;
-  ioctl(STDOUT_FILENO, TIOCGWINSZ, &tty_dims);
+static uint16_t Screen_push_block(Screen *self, LayoutBlock block) {
+  self->layout[self->layout_count] = block;
+  self->layout_count += 1;
+  return self->layout_count - 1;
+}
+
+// divides the area of the block evenly between its children, the columns
+// (or rows) that are left over go to the first ones
+static void Screen_place(Screen *self, uint16_t index) {
+  LayoutBlock *block = &self->layout[index];
+  if (block->type == LAYOUT_SLAVE_WINDOW) {
+    Frame *frame = &self->frames[block->block.slave_window.frame];
+    frame->offset_x = block->offset_x;
+    frame->offset_y = block->offset_y;
+    frame->width = block->width;
+    frame->height = block->height;
+    return;
+  }
+  LayoutMaster master = block->block.master_window;
+  uint16_t extent = master.vertical ? block->width : block->height;
+  uint16_t dividers = master.child_count - 1;
+  uint16_t share = (extent > dividers) ? (extent - dividers) / master.child_count : 0;
+  uint16_t extra = (extent > dividers) ? (extent - dividers) % master.child_count : 0;
+  uint16_t start = master.vertical ? block->offset_x : block->offset_y;
+  for (uint16_t i = 0; i < master.child_count; i += 1) {
+    LayoutBlock *child = &self->layout[master.first_child + i];
+    uint16_t size = share + (i < extra);
+    child->offset_x = master.vertical ? start : block->offset_x;
+    child->offset_y = master.vertical ? block->offset_y : start;
+    child->width = master.vertical ? size : block->width;
+    child->height = master.vertical ? block->height : size;
+    start += size + 1;
+    Screen_place(self, master.first_child + i);
+  }
+}
 
-  // Window *frame1, *frame2;
-  self->top.source = self->bottom.source = NULL;
+// gives every window with something to show a frame and rebuilds the layout
+// tree when that set, the orientation or the terminal size changed: the
+// frames are put side by side (or stacked) as long as each keeps the minimum
+// size, past that the lines of frames are stacked (or put side by side) too
+static void Screen_update_layout(Screen *self) {
+  if (self->frames == NULL && self->windows.item_count > 0) {
+    self->frames = calloc(self->windows.item_count, sizeof(Frame));
+    // a root and a master per line at most on top of a block per frame
+    self->layout = calloc(2 * self->windows.item_count + 1, sizeof(LayoutBlock));
+  }
+  uint8_t shown_count = 0;
+  bool changed = false;
   for (size_t i = 0; i < self->windows.item_count; i += 1) {
-    if (self->windows.items[i].lines.item_count == 0) { continue; }
-    if (self->top.source == NULL) { self->top.source = &self->windows.items[i]; }
-    else if (self->bottom.source == NULL) { self->bottom.source = &self->windows.items[i]; }
+    // NOTE a followed file that was emptied keeps its frame
+    Window *window = &self->windows.items[i];
+    if (window->hidden) { continue; }
+    if (Window_line_count(window) == 0 && !atomic_load(&window->following)) { continue; }
+    if (shown_count >= self->shown_count || self->frames[shown_count].source != window) {
+      self->frames[shown_count] = (Frame){ .source = window };
+      changed = true;
+    }
+    shown_count += 1;
+  }
+  changed |= shown_count != self->shown_count;
+  self->shown_count = shown_count;
+  if (shown_count == 0 || (!changed && !self->redraw_all)) { return; }
+
+  uint16_t width = (self->cols > 2) ? self->cols - 2 : 0;
+  uint16_t height = (self->rows > 2) ? self->rows - 2 : 0;
+  uint16_t extent = self->vertical ? width : height;
+  uint16_t minimum = self->vertical ? LAYOUT_MIN_FRAME_WIDTH : LAYOUT_MIN_FRAME_HEIGHT;
+  // NOTE every frame but the last is followed by a divider
+  uint16_t per_line = (extent + 1) / (minimum + 1);
+  if (per_line < 1) { per_line = 1; }
+  if (per_line > shown_count) { per_line = shown_count; }
+  uint16_t line_count = (shown_count + per_line - 1) / per_line;
+
+  self->layout_count = 0;
+  LayoutBlock root = { .offset_x = 1, .offset_y = 1, .width = width, .height = height };
+  if (line_count == 1) {
+    root.type = LAYOUT_MASTER;
+    root.block.master_window = (LayoutMaster){ .vertical = self->vertical, .first_child = 1, .child_count = shown_count };
+    Screen_push_block(self, root);
+    for (uint8_t i = 0; i < shown_count; i += 1) {
+      Screen_push_block(self, (LayoutBlock){ .type = LAYOUT_SLAVE_WINDOW, .block.slave_window.frame = i });
+    }
+  }else {
+    root.type = LAYOUT_MASTER;
+    root.block.master_window = (LayoutMaster){ .vertical = !self->vertical, .first_child = 1, .child_count = line_count };
+    Screen_push_block(self, root);
+    uint16_t first_frame_block = 1 + line_count;
+    for (uint16_t line = 0; line < line_count; line += 1) {
+      uint16_t first = line * per_line;
+      uint16_t count = (shown_count - first < per_line) ? shown_count - first : per_line;
+      LayoutBlock master = { .type = LAYOUT_MASTER };
+      master.block.master_window = (LayoutMaster){
+        .vertical = self->vertical, .first_child = first_frame_block + first, .child_count = count
+      };
+      Screen_push_block(self, master);
+    }
+    for (uint8_t i = 0; i < shown_count; i += 1) {
+      Screen_push_block(self, (LayoutBlock){ .type = LAYOUT_SLAVE_WINDOW, .block.slave_window.frame = i });
+    }
+  }
+  Screen_place(self, 0);
+  self->redraw_all = true;
+}
+
+// draws the divider after every child of every master but the last
+static void Screen_draw_dividers(Screen *self, Canvas *canvas) {
+  for (uint16_t i = 0; i < self->layout_count; i += 1) {
+    LayoutBlock *block = &self->layout[i];
+    if (block->type != LAYOUT_MASTER) { continue; }
+    LayoutMaster master = block->block.master_window;
+    for (uint16_t child = 0; child + 1 < master.child_count; child += 1) {
+      LayoutBlock *before = &self->layout[master.first_child + child];
+      if (master.vertical) {
+        uint16_t col = before->offset_x + before->width;
+        for (uint16_t row = block->offset_y; row < block->offset_y + block->height; row += 1) {
+          Canvas_fill(canvas, row, col, 1, '|', STYLE_DEFAULT);
+        }
+      }else {
+        Canvas_fill(canvas, before->offset_y + before->height, block->offset_x, block->width, '=', STYLE_DEFAULT);
+      }
+    }
   }
+}
 
-  if (self->top.source == NULL) {
+void Screen_render(Screen *self) {
+  Screen_update_layout(self);
+  if (self->shown_count == 0) {
     fprintf(stderr, "WARN: invalid condition, no windows registered\n");
     return;
   }
-  self->split_mode = self->bottom.source != NULL;
-
-  // uint16_t top_window_rows;
-  // uint16_t bottom_window_rows;
-  if (self->split_mode) {
-    uint16x2 window_sizes = calculate_window_dims(tty_dims);
-    self->top.height = window_sizes.a;
-    // top_window_rows = window_sizes.a;
-    self->bottom.height = window_sizes.b;
-    // bottom_window_rows = window_sizes.b;
-  // }else { top_window_rows = tty_dims.ws_row; }
-  }else { self->top.height = tty_dims.ws_row; }
-  
-
-  // if (frame1 != NULL) { Window_update(frame1); }
-  // if (frame2 != NULL) { Window_update(frame2 ); }
-  Window_update(self->top.source);
-  if (self->split_mode) { Window_update(self->bottom.source); }
-
-
 
-  fprintf(stdout, "%s%s", ANSI_MOVE_CURSOR_TO_ORIGIN, ANSI_ERASE_SCREEN);
-
-  // NOTE that the first row or col is not position 0 but position 1 (like how lua indexes arrays)
-
-  // left border
-  move_cursor_to_position(stdout, 3, 0);
-  for (uint16_t i = 1; i < tty_dims.ws_row; i += 1) { fprintf(stdout, "|\n\r"); }
-
-  for (uint16_t i = 2; i < tty_dims.ws_row; i += 1) {
-    move_cursor_to_position(stdout, i, tty_dims.ws_col);
-    fprintf(stdout, "|");
+  uint16_t rows = self->rows, cols = self->cols;
+  if (rows != self->front.rows || cols != self->front.cols) {
+    // the terminal is erased once and its canvas cleared to match, from then
+    // on only the cells that change between frames get written
+    OutputBuffer_push_str(&self->output, ANSI_MOVE_CURSOR_TO_ORIGIN);
+    OutputBuffer_push_str(&self->output, ANSI_ERASE_SCREEN);
+    Canvas_resize(&self->front, rows, cols);
+    Canvas_resize(&self->back, rows, cols);
+    for (uint8_t i = 0; i < self->shown_count; i += 1) { self->frames[i].rendered_source = NULL; }
+  }else if (self->redraw_all) { Canvas_clear(&self->back); }
+  // NOTE frames that are not dirty keep what they drew on the back canvas
+  if (rows < 4 || cols < 4) { Screen_flush(self); return; }
+
+  // NOTE canvas rows and columns count from 0, the top and bottom rows
+  // and the first and last columns are the border
+  Canvas *canvas = &self->back;
+  Canvas_fill(canvas, 0, 0, cols, '=', STYLE_DEFAULT);
+  Canvas_fill(canvas, rows - 1, 0, cols, '=', STYLE_DEFAULT);
+  for (uint16_t i = 1; i < rows - 1; i += 1) {
+    Canvas_fill(canvas, i, 0, 1, '|', STYLE_DEFAULT);
+    Canvas_fill(canvas, i, cols - 1, 1, '|', STYLE_DEFAULT);
+  }
+  Screen_draw_dividers(self, canvas);
+
+  Window *focused = Screen_focused_window(self);
+  Window *waiting = NULL;
+  for (uint8_t i = 0; i < self->shown_count; i += 1) {
+    Frame *frame = &self->frames[i];
+    Window *window = frame->source;
+    if (window->jump.type != WINDOW_JUMP_NONE) { frame->dirty = true; }
+    if (!frame->dirty && !self->redraw_all) { continue; }
+    Window_update(window);
+    if (Frame_land_jump(frame) && waiting == NULL) { waiting = window; }
+    Frame_follow(frame);
+    if (frame->width == 0 || frame->height == 0) { continue; }
+    for (uint16_t row = frame->offset_y; row < frame->offset_y + frame->height; row += 1) {
+      Canvas_fill(canvas, row, frame->offset_x, frame->width, ' ', STYLE_DEFAULT);
+    }
+    Window_render(
+      window, canvas, frame->offset_x, frame->offset_y, frame->width, frame->height, window == focused
+    );
+  }
+  if (waiting != NULL) {
+    snprintf(self->status, sizeof(self->status), "jumping... %zu lines indexed (any key cancels)",
+      Window_line_count(waiting)
+    );
+  }else if (self->jump_waiting) { self->status[0] = '\0'; }
+  self->jump_waiting = waiting != NULL;
+
+  // the prompt and status messages go over the bottom border
+  if (self->input_mode != INPUT_NORMAL) {
+    const char *sigil = (self->input_mode == INPUT_GOTO_LINE) ? ":"
+      : (self->input_mode == INPUT_FILTER) ? "&"
+      : self->prompt_backward ? "?" : "/";
+    uint16_t prompt_col = Canvas_put_text(canvas, rows - 1, 1, cols - 1, sigil, 1, STYLE_DEFAULT);
+    Canvas_put_text(canvas, rows - 1, prompt_col, cols - 1, self->prompt, self->prompt_length, STYLE_DEFAULT);
+  }else if (self->status[0] != '\0') {
+    Canvas_put_text(
+      canvas, rows - 1, 1, cols - 1, self->status, strlen(self->status),
+      (CellStyle){ .flags = STYLE_REVERSE }
+    );
   }
 
-  fprintf(stdout, "%s", ANSI_MOVE_CURSOR_TO_ORIGIN);
-  for (uint16_t i = 0; i < tty_dims.ws_col; i += 1) { fprintf(stdout, "="); }
-
-  move_cursor_to_position(stdout, tty_dims.ws_row, 0);
-  for (uint16_t i = 0; i < tty_dims.ws_col; i += 1) { fprintf(stdout, "="); }
-
-  // TODO move this into a new Frame_render function to
-  // combine functionality across Window_render and Screen_render to
-  // a single source
-  if (!self->split_mode) { self->top.height -= 1; } // this is to fix sizing for the bottom border
-  Window_render(self->top.source, 2, 2, tty_dims.ws_col - 2, self->top.height- 2, self->focus == 0);
-  if (self->split_mode) {
-    // render divider
-    move_cursor_to_position(stdout, self->top.height + 1, 0);
-    for_range(size_t, i, 0, tty_dims.ws_col) { fprintf(stdout, "="); }
-
-    Window_render(self->bottom.source, 2, self->top.height + 2, tty_dims.ws_col - 2, self->bottom.height - 3, self->focus == 1);
+  for (uint8_t i = 0; i < self->shown_count; i += 1) {
+    Frame *frame = &self->frames[i];
+    Frame_render_progress(frame, canvas);
+    // NOTE the terminal can only scroll whole rows, so only frames
+    // spanning the width of the terminal are scrolled in place
+    if (frame->offset_x == 1 && frame->width == cols - 2) {
+      Frame_scroll_terminal(frame, &self->front, &self->output);
+    }else { frame->rendered_source = NULL; }
+    frame->dirty = false;
   }
-  fflush(stdout);
+  self->redraw_all = false;
 
-}
+  Canvas_present(&self->back, &self->front, &self->output);
+  Screen_flush(self);
 
+}
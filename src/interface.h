@@ -4,15 +4,16 @@
 #include "stdint.h"
 
 #include "plustypes.h"
+#include "linestore.h"
+#include "canvas.h"
+#include "sgr.h"
+#include "pool.h"
 #include <bits/pthreadtypes.h>
 
 #ifndef INTERFACE_H
 #define INTERFACE_H
 
 
-void move_cursor_to_col(FILE *stream, size_t col);
-void move_cursor_to_position(FILE *stream, size_t row, size_t col);
-
 void save_terminal();
 void restore_terminal();
 void enter_raw_mode();
@@ -20,21 +21,164 @@ void enter_raw_mode();
 #define for_range(ItemT, ItemName, start, end) \
 for (ItemT ItemName = start; ItemName < end; ItemName += 1)
 
-typedef char * CharString;
+declare_SpscList(size_t)
+
+// every line of a stream from first_line up to the first_line of the next
+// stamp was ended by a read that returned at time (see line_stamp_now)
+typedef struct {
+  size_t first_line;
+  uint64_t time;
+} LineStamp;
+
+declare_SpscList(LineStamp)
+
+// the nanoseconds of CLOCK_MONOTONIC_COARSE, which is cheap enough to read
+// after every read but only moves every few milliseconds
+uint64_t line_stamp_now();
+
+// a borrowed, non null-terminated line of a Window
+typedef struct {
+  const char *data;
+  size_t length;
+} LineView;
+
+typedef enum {
+  // lines are read from a pipe or socket and copied into a LineStore
+  WINDOW_SOURCE_STREAM,
+  // lines are read directly out of a read-only mapping of a regular file
+  WINDOW_SOURCE_FILE,
+  // the lines of other windows, interleaved in the order they were read
+  WINDOW_SOURCE_MERGED,
+} WindowSourceType;
+
+typedef enum {
+  WINDOW_JUMP_NONE,
+  // to line target, or the last line if the source has fewer
+  WINDOW_JUMP_LINE,
+  // to the line byte target of the file is in
+  WINDOW_JUMP_BYTE,
+} WindowJumpType;
+
+typedef struct {
+  WindowJumpType type;
+  size_t target;
+} WindowJump;
+
+// what is kept about a line that was on screen recently, so that it is
+// not worked out again on every frame
+typedef struct {
+  size_t line;
+  // the line without its escape sequences, when it had any
+  bool styled;
+  StyledText text;
+  // the first character that is visible with the frame scrolled
+  // column_target columns to the right, and the display column it starts at
+  size_t column_target;
+  size_t column_offset;
+  size_t column;
+  // the rows the line takes when wrapped at rows_width columns, and where
+  // the row row_target starts (the first one shown when the line is at the top)
+  size_t rows;
+  size_t rows_width;
+  size_t row_target;
+  size_t row_offset;
+} LineCache;
+
+// see filter.h
+typedef struct Filter Filter;
+// see merge.h
+typedef struct Merge Merge;
 
-declare_List(CharString)
+// lines are cached by index modulo this, a frame is never this tall
+#define WINDOW_LINE_CACHE_SIZE 256
+// the wrap index keeps the total rows of each block of this many lines
+#define WRAP_BLOCK_LINES 1024
 
 typedef struct {
-  pthread_mutex_t new_lines_mutex;
-  List_CharString lines;
-  List_CharString new_lines;
+  WindowSourceType source_type;
+  // the reader thread pushes lines here and Window_update takes them
+  LineStore store;
+  // NOTE only used by WINDOW_SOURCE_FILE windows, each entry is the
+  // offset one past the end of a line (the newline or the end of the file)
+  SpscList_size_t line_ends;
+  // NOTE only used by WINDOW_SOURCE_STREAM windows, the reader stamps the
+  // lines of every read with the time it returned, for merged windows
+  SpscList_LineStamp stamps;
+  // set by the reader once everything it has read is published, and the
+  // stamp of its last read, so a merge knows how old the lines still to
+  // come from it can be (see Merge_update)
+  _Atomic bool drained;
+  _Atomic uint64_t read_stamp;
+  // the stream is the stderr of a spawned command, its lines are tagged
+  bool from_stderr;
+  // NOTE only used by WINDOW_SOURCE_MERGED windows
+  Merge *merge;
+  // the window is only shown through a merged window (--merge), whose
+  // wake_fd is signaled along with its own, or -1
+  bool hidden;
+  int merge_wake_fd;
+  // the file is mapped at the start of a larger reserved range of address
+  // space, so it can grow in place while it is followed
+  const char *file_map;
+  size_t file_size, file_map_reserved;
+  // the size of the file when it was mapped, which the index is built
+  // over in the background, and how much of it has been indexed so far
+  size_t index_size;
+  _Atomic size_t indexed_bytes;
+  // the workers that index large files in parallel
+  Pool *pool;
+  // the file to reopen when it is truncated or replaced, NULL if unknown
+  const char *path;
+  // set by the file reader when the file shrank or another file took its path
+  _Atomic bool needs_reopen;
+  // an eventfd the UI signals when following starts so the file reader wakes up
+  int follow_fd;
+  // the number of lines taken by the UI thread as of the last Window_update
+  size_t line_count;
   size_t window_start;
+  // long lines flow onto as many rows of the frame as they need (w), and
+  // the frame starts at row row_start of line window_start
+  bool wrap;
+  size_t row_start;
+  // the columns lines are wrapped at, the width of the frame's text as of
+  // the last render, the wrap index is built for it
+  size_t wrap_width;
+  // the rows of every block of WRAP_BLOCK_LINES lines, counted the first
+  // time a move passes over the whole block (0 until then) and kept until
+  // wrap_width changes, so long moves skip blocks instead of lines
+  size_t *wrap_blocks;
+  size_t wrap_block_capacity;
+  // the lines of a block with escape sequences are parsed into this to count them
+  StyledText wrap_scratch;
+  // the display columns of every line scrolled off to the left
+  size_t column_start;
+  // the lines shown last, parsed for their colors and where they were cut
+  // for column_start (so scrolling further right on a long line only has
+  // to look at the columns it moved past)
+  LineCache *line_cache;
+  // set by the reader once it has indexed all of the source, the file as
+  // it was opened or the stream up to its end, and its value as of the
+  // last Window_update (which the UI reads so that it agrees with line_count)
+  _Atomic bool indexed;
+  bool fully_indexed;
+  // a jump that lands once the index reaches its target (see Frame_land_jump)
+  WindowJump jump;
+  // a line to point out (the last search match) or SIZE_MAX for none
+  size_t marked_line;
+  // while set the window shows only the lines matching its pattern (&), and
+  // window_start, the wrap index and the moves count lines of that view
+  Filter *filter;
+  // the reader keeps reading as the source grows (F or --follow), and while
+  // stick_to_bottom is set the frame keeps the last lines in view
+  _Atomic bool following;
+  bool stick_to_bottom;
   pthread_t reader_thread;
   int source_fd;
-  // char *next_line;
-
-  // communication to reader thread
-  // _Atomic bool next_line_is_ready;
+  // the reader of a stream prints how fast it read it once it ends (--throughput)
+  bool report_throughput;
+  // an eventfd the reader thread signals after publishing lines
+  // so the main loop can sleep until there is something to show
+  int wake_fd;
 } Window;
 
 declare_List(Window)
@@ -48,6 +192,23 @@ typedef enum {
   WINDOW_QUIT = 'q',
   WINDOW_SWITCH_NEXT = 'h',
   WINDOW_SWITCH_PREV = 'l',
+  WINDOW_SEARCH_FORWARD = '/',
+  WINDOW_SEARCH_BACKWARD = '?',
+  WINDOW_SEARCH_NEXT = 'n',
+  WINDOW_SEARCH_PREV = 'N',
+  WINDOW_SEARCH_COUNT = '=',
+  WINDOW_FOLLOW = 'F',
+  WINDOW_TOP = 'g',
+  WINDOW_BOTTOM = 'G',
+  WINDOW_HOME = 0x485b1b,
+  WINDOW_END = 0x465b1b,
+  WINDOW_GOTO_LINE = ':',
+  WINDOW_GOTO_PERCENT = '%',
+  WINDOW_SCROLL_LEFT = 0x445b1b,
+  WINDOW_SCROLL_RIGHT = 0x435b1b,
+  WINDOW_WRAP = 'w',
+  WINDOW_VERTICAL = 'v',
+  WINDOW_FILTER = '&',
   WINDOW_CONTROL_NONE = 0x0,
 } WindowControl;
 
@@ -59,13 +220,57 @@ typedef union {
 // void cleanup_thread(pthread_t thread_id);
 void free_residuals();
 
-Window Window_new(int source_fd);
+// path is the file source_fd was opened from, or NULL, a large file is
+// indexed on the workers of pool
+Window Window_new(int source_fd, const char *path, size_t memory_budget, Pool *pool);
+// a window of the lines of every source in the order they were read, the
+// sources are hidden and must outlive it
+Window Window_new_merged(Window **sources, uint8_t source_count);
 void Window_spawn_reader(Window *self);
+void Window_set_following(Window *self, bool following);
+// true once the reader has stopped because the file has to be reopened
+bool Window_needs_reopen(Window *self);
+// WARN nothing else may be reading the window's lines while it is reopened
+void Window_reopen(Window *self);
+// replaces the pages of a mapped file that was truncated with zeroes
+// instead of dying of SIGBUS, until the window reopens the file
+void install_truncation_handler();
 // returns whether the window has been updated
 bool Window_update(Window *self);
-void Window_render(Window *self, uint16_t offset_x, uint16_t offset_y, uint16_t width, uint16_t height, bool focused);
+// the number of lines a file that is still being indexed is expected to
+// end up with, judging by the lines in what has been indexed so far
+size_t Window_expected_line_count(Window *self);
+// signals the wake_fd of a window once there is something new to show
+void Window_notify(Window *self);
+// clears the wake_fd of a window after it has been polled readable
+void Window_acknowledge_wake(Window *self);
+size_t Window_line_count(Window *self);
+// the lines the window shows, all of them or the matches of its filter
+size_t Window_view_count(Window *self);
+// the line at index of the view, and the first index showing a line >= line
+size_t Window_view_line(Window *self, size_t index);
+size_t Window_view_index(Window *self, size_t line);
+// shows only the lines matching pattern, or every line again if it is
+// empty, returns an error message if the pattern is invalid
+const char *Window_set_filter(Window *self, const char *pattern, size_t pattern_length);
+// NOTE a line is only valid until the next Window_get_line with its pin,
+// pass the same pin for every line and release it when done
+LineView Window_get_line(Window *self, size_t index, LinePin *pin);
+void Window_release_pin(Window *self, LinePin *pin);
+// whether the line came from the stderr of a spawned command
+bool Window_line_from_stderr(Window *self, size_t index);
+void Window_render(
+  Window *self, Canvas *canvas,
+  uint16_t offset_x, uint16_t offset_y, uint16_t width, uint16_t height,
+  bool focused
+);
+// moves count lines, or count rows of the frame while wrapping
 void Window_move_up(Window *self, size_t count);
-void Window_move_down(Window *self, size_t count);
+// moves at most to the last page of a frame height rows tall
+void Window_move_down(Window *self, size_t count, size_t height);
+void Window_set_wrap(Window *self, bool wrap);
+void Window_move_left(Window *self, size_t columns);
+void Window_move_right(Window *self, size_t columns);
 WindowControl Window_handle_input(Window *self, uint16_t tty_rows, bool *needs_redraw);
 void Window_free(Window *self);
 
@@ -77,22 +282,89 @@ typedef enum {
 typedef struct {
   Window *source;
   uint16_t offset_x, offset_y, width, height;
+  // the frame has to be drawn again, frames that are not dirty keep what
+  // they showed last (see Screen_mark_dirty)
+  bool dirty;
+  // what this frame showed on the terminal after the previous render,
+  // used to scroll the rows that are still visible instead of redrawing them
+  Window *rendered_source;
+  size_t rendered_start, rendered_row;
+  bool rendered_wrap;
+  uint16_t rendered_offset_y, rendered_height;
 } Frame;
 
+// see search.h
+typedef struct Search Search;
+// a node of the tree that places the frames (see interface.c)
+typedef struct LayoutBlock LayoutBlock;
+
+typedef enum {
+  INPUT_NORMAL,
+  // keys are typed into the search prompt on the bottom border
+  INPUT_PROMPT,
+  // a line number (or a percentage) is typed into the prompt after :
+  INPUT_GOTO_LINE,
+  // the pattern of a filter is typed into the prompt after &
+  INPUT_FILTER,
+} InputMode;
+
+#define SCREEN_PROMPT_MAX 256
+
 // a conecetpual screen that consumes the entire tty with
 // one or more Windows dividing it
 typedef struct {
   List_Window windows;
-  uint8_t top_window;
+  // the index of the window keys go to
   uint8_t focus;
-  bool split_mode;
-  Frame top, bottom;
+  // a frame for each window that has something to show, placed by the
+  // layout tree (layout[0] is its root), both are rebuilt when the shown
+  // windows, the orientation or the size of the terminal change
+  Frame *frames;
+  uint8_t shown_count;
+  LayoutBlock *layout;
+  uint16_t layout_count;
+  // frames go side by side rather than stacked (v or --vertical)
+  bool vertical;
+  // something has to be drawn, and whether that is every frame rather
+  // than only the dirty ones
   bool needs_redraw;
+  bool redraw_all;
+  // the size of the terminal, only asked for again when it reports a resize
+  // (see Screen_resize)
+  uint16_t rows, cols;
+  // front is what is currently on the terminal, back is the frame being drawn
+  Canvas front, back;
+  OutputBuffer output;
+  // when set every frame reports what it cost on stderr (see --frame-stats)
+  bool report_frame_stats;
+  size_t frame_count, total_frame_bytes, total_frame_syscalls;
+
+  Search *search;
+  InputMode input_mode;
+  char prompt[SCREEN_PROMPT_MAX];
+  size_t prompt_length;
+  bool prompt_backward;
+  // a number typed before a command (0 for none), <count>n jumps to the
+  // count'th match and <count>g to line count
+  size_t count;
+  // a jump of the focused window is waiting for the index, any key cancels it
+  bool jump_waiting;
+  // a message shown on the bottom border until the next key press
+  char status[96];
 } Screen;
 
+// reads the size of the terminal, on start and after every SIGWINCH,
+// returns whether it changed
+bool Screen_resize(Screen *self);
+// has the frames showing window drawn again on the next render
+void Screen_mark_dirty(Screen *self, Window *window);
 InterfaceCommand Screen_read_stdin( Screen *self );
 void Screen_spawn_stdin_reader(Screen *self);
 void Screen_render(Screen *self);
+void Screen_flush(Screen *self);
+// called by the main loop when the search's wake_fd is readable
+void Screen_handle_search_wake(Screen *self);
+void Screen_reopen_window(Screen *self, Window *window);
 
 #endif
 
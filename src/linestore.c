@@ -0,0 +1,585 @@
+// O_TMPFILE
+#define _GNU_SOURCE
+
+#include "stdint.h"
+#include "stdio.h"
+#include "stdlib.h"
+#include "string.h"
+#include "stdbool.h"
+#include "unistd.h"
+#include "errno.h"
+#include "fcntl.h"
+#include "sys/mman.h"
+
+#include "linestore.h"
+#include "scan.h"
+#include "lz.h"
+
+#include "plustypes.h"
+
+
+LineStore LineStore_new(size_t memory_budget) {
+  return (LineStore){
+    // NOTE calloc leaves the untouched tail of the directory unbacked
+    .blocks = calloc(LINESTORE_MAX_BLOCKS, sizeof(LineBlock)),
+    .block_count = 0,
+    .line_is_open = false,
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+    .cold_blocks = PTHREAD_COND_INITIALIZER,
+    .compressor_running = false,
+    .stopping = false,
+    .memory_budget = memory_budget,
+    .resident = calloc(LINESTORE_MAX_BLOCKS, sizeof(uint32_t)),
+    .resident_count = 0,
+    .spill_fd = -1,
+  };
+}
+
+// the line ends grow down from the end of the block, the end of the
+// block's line i is at ends[-1 - i]
+static uint32_t *LineBlock_ends(LineBlock *block) {
+  return (uint32_t *)(block->data + block->size);
+}
+
+static uint32_t LineBlock_index_bytes(LineBlock *block) {
+  return block->line_count * sizeof(uint32_t);
+}
+
+// the bytes of a block that are in use, its line bytes and its line ends
+static size_t LineBlock_content_size(LineBlock *block) {
+  return block->used + LineBlock_index_bytes(block);
+}
+
+static size_t LineBlock_memory(LineBlock *block) {
+  return ((block->data != NULL) ? block->size : 0)
+    + ((block->compressed != NULL) ? block->compressed_size : 0);
+}
+
+// NOTE block data is mapped rather than malloced so that freeing it gives
+// the memory back right away, malloc holds on to freed chunks this size
+static char *LineBlock_new_data(size_t size) {
+  void *data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  return (data == MAP_FAILED) ? NULL : data;
+}
+
+static void LineBlock_free_data(char *data, size_t size) {
+  if (data != NULL) { munmap(data, size); }
+}
+
+// the data of the block can be freed without losing anything
+static bool LineBlock_has_copy(LineBlock *block) {
+  return block->compressed_size > 0 || block->spilled;
+}
+
+// opens a temp file that is gone from the filesystem as soon as it is closed
+static int open_spill_file() {
+  const char *directory = getenv("TMPDIR");
+  if (directory == NULL) { directory = "/tmp"; }
+  int spill_fd = open(directory, O_TMPFILE | O_RDWR | O_CLOEXEC, 0600);
+  if (spill_fd >= 0) { return spill_fd; }
+
+  // O_TMPFILE is not supported by every filesystem
+  char path[4096];
+  snprintf(path, sizeof(path), "%s/pager-spill-XXXXXX", directory);
+  spill_fd = mkstemp(path);
+  if (spill_fd >= 0) {
+    unlink(path);
+    fcntl(spill_fd, F_SETFD, FD_CLOEXEC);
+  }
+  return spill_fd;
+}
+
+static bool write_fully(int fd, const char *data, size_t length, uint64_t offset) {
+  size_t written = 0;
+  while (written < length) {
+    ssize_t result = pwrite(fd, data + written, length - written, offset + written);
+    if (result < 0 && errno == EINTR) { continue; }
+    if (result <= 0) { return false; }
+    written += result;
+  }
+  return true;
+}
+
+static bool read_fully(int fd, char *data, size_t length, uint64_t offset) {
+  size_t read_size = 0;
+  while (read_size < length) {
+    ssize_t result = pread(fd, data + read_size, length - read_size, offset + read_size);
+    if (result < 0 && errno == EINTR) { continue; }
+    if (result <= 0) {
+      memset(data + read_size, 0, length - read_size);
+      return false;
+    }
+    read_size += result;
+  }
+  return true;
+}
+
+// replaces the data and compressed copy of a block, keeping the resident
+// blocks and resident_bytes up to date, the caller frees the old ones
+//
+// NOTE call with the mutex held
+static void LineStore_set_memory(LineStore *self, uint32_t index, char *data, char *compressed) {
+  LineBlock *block = &self->blocks[index];
+  size_t before = LineBlock_memory(block);
+  // NOTE pinned readers use data while the compressed copy changes
+  if (block->data != data) { block->data = data; }
+  if (block->compressed != compressed) { block->compressed = compressed; }
+  size_t after = LineBlock_memory(block);
+  self->resident_bytes = self->resident_bytes - before + after;
+
+  if (before == 0 && after > 0) {
+    self->resident[self->resident_count] = index;
+    self->resident_count += 1;
+  }else if (before > 0 && after == 0) {
+    for (uint32_t slot = 0; slot < self->resident_count; slot += 1) {
+      if (self->resident[slot] != index) { continue; }
+      self->resident[slot] = self->resident[self->resident_count - 1];
+      self->resident_count -= 1;
+      break;
+    }
+  }
+}
+
+static void LineStore_touch(LineStore *self, uint32_t index) {
+  self->use_clock += 1;
+  self->blocks[index].last_used = self->use_clock;
+}
+
+// writes a sealed block to the end of the spill file, its compressed copy
+// if it has one and otherwise its line bytes followed by its line ends,
+// the mutex is released while writing and the block is pinned so nothing
+// frees it
+static bool LineStore_spill(LineStore *self, uint32_t index) {
+  if (self->spill_fd < 0) { self->spill_fd = open_spill_file(); }
+  if (self->spill_fd < 0) {
+    fprintf(stderr, "WARN: failed to create scrollback spill file, keeping it all in memory -> %s\n", strerror(errno));
+    return false;
+  }
+  LineBlock *block = &self->blocks[index];
+  uint32_t index_bytes = LineBlock_index_bytes(block);
+  bool compressed = block->compressed_size > 0;
+  uint64_t offset = self->spill_size;
+  self->spill_size += compressed ? block->compressed_size : LineBlock_content_size(block);
+  block->pins += 1;
+  pthread_mutex_unlock(&self->mutex);
+
+  bool written = compressed
+    ? write_fully(self->spill_fd, block->compressed, block->compressed_size, offset)
+    : write_fully(self->spill_fd, block->data, block->used, offset)
+      && write_fully(self->spill_fd, block->data + block->size - index_bytes, index_bytes, offset + block->used);
+
+  pthread_mutex_lock(&self->mutex);
+  block->pins -= 1;
+  if (!written) {
+    fprintf(stderr, "WARN: failed to write to scrollback spill file, keeping it all in memory -> %s\n", strerror(errno));
+    return false;
+  }
+  block->spilled = true;
+  block->spill_offset = offset;
+  return true;
+}
+
+// compresses a sealed block into a copy in memory, the line ends are
+// stored as line lengths which compress about as well as the lines do,
+// a block that does not shrink by an eighth is left as it is
+//
+// NOTE call with the mutex held, it is released while compressing and the
+// block is pinned so nothing frees it
+static void LineStore_compress(LineStore *self, uint32_t index) {
+  LineBlock *block = &self->blocks[index];
+  block->pins += 1;
+  pthread_mutex_unlock(&self->mutex);
+
+  size_t content_size = LineBlock_content_size(block);
+  char *content = malloc(content_size);
+  memcpy(content, block->data, block->used);
+  uint32_t *ends = LineBlock_ends(block);
+  for (uint32_t line = 0; line < block->line_count; line += 1) {
+    uint32_t length = ends[-1 - (int64_t)line] - ((line == 0) ? 0 : ends[-(int64_t)line]);
+    memcpy(content + content_size - (line + 1) * sizeof(uint32_t), &length, sizeof(length));
+  }
+  size_t capacity = content_size - content_size / 8;
+  char *compressed = malloc(capacity);
+  size_t compressed_size = lz_compress(content, content_size, compressed, capacity);
+  free(content);
+
+  pthread_mutex_lock(&self->mutex);
+  block->pins -= 1;
+  if (compressed_size == 0) {
+    free(compressed);
+    block->incompressible = true;
+    return;
+  }
+  block->compressed_size = compressed_size;
+  LineStore_set_memory(self, index, block->data, realloc(compressed, compressed_size));
+}
+
+// decompresses a block into data, which is block->size bytes
+static bool LineStore_decompress(LineBlock *block, const char *compressed, char *data) {
+  uint32_t index_bytes = LineBlock_index_bytes(block);
+  if (!lz_decompress(compressed, block->compressed_size, data, LineBlock_content_size(block))) { return false; }
+  // the line lengths come right after the line bytes
+  memmove(data + block->size - index_bytes, data + block->used, index_bytes);
+  uint32_t *ends = (uint32_t *)(data + block->size);
+  for (uint32_t line = 1; line < block->line_count; line += 1) {
+    ends[-1 - (int64_t)line] += ends[-(int64_t)line];
+  }
+  return true;
+}
+
+// frees the memory of the least recently used sealed blocks until the
+// resident ones fit in the budget again, a tier at a time: the data of a
+// block is freed once it is compressed (or spilled if it does not compress)
+// and its compressed copy once that is spilled
+//
+// blocks that would have to be compressed or written are only evicted when
+// may_write is set, the rest are simply freed
+//
+// NOTE call with the mutex held
+static void LineStore_trim(LineStore *self, bool may_write) {
+  while (self->memory_budget > 0 && self->resident_bytes > self->memory_budget) {
+    uint32_t victim = UINT32_MAX;
+    for (uint32_t slot = 0; slot < self->resident_count; slot += 1) {
+      uint32_t index = self->resident[slot];
+      LineBlock *block = &self->blocks[index];
+      bool sealed = index + 1 < self->block_count;
+      bool has_copy = (block->data != NULL) ? LineBlock_has_copy(block) : block->spilled;
+      if (!sealed || block->pins > 0 || (!has_copy && !may_write)) { continue; }
+      if (victim == UINT32_MAX || block->last_used < self->blocks[victim].last_used) { victim = index; }
+    }
+    if (victim == UINT32_MAX) { return; }
+
+    LineBlock *block = &self->blocks[victim];
+    if (block->data != NULL && !LineBlock_has_copy(block)) {
+      if (!block->incompressible) {
+        LineStore_compress(self, victim);
+      }else if (!LineStore_spill(self, victim)) {
+        self->memory_budget = 0;
+        return;
+      }
+      // it may have been pinned while the mutex was released
+      continue;
+    }
+    if (block->data != NULL) {
+      char *data = block->data;
+      LineStore_set_memory(self, victim, NULL, block->compressed);
+      LineBlock_free_data(data, block->size);
+      continue;
+    }
+    if (!block->spilled && !LineStore_spill(self, victim)) {
+      self->memory_budget = 0;
+      return;
+    }
+    if (block->pins > 0 || block->data != NULL) { continue; }
+    char *compressed = block->compressed;
+    LineStore_set_memory(self, victim, NULL, NULL);
+    free(compressed);
+  }
+}
+
+// keeps at most LINESTORE_HOT_BLOCKS sealed blocks as they are, compressing
+// the least recently used of the others and freeing their data
+static void *LineStore_compress_cold(void *args) {
+  LineStore *self = args;
+  pthread_mutex_lock(&self->mutex);
+  while (!self->stopping) {
+    uint32_t hot_count = 0;
+    uint32_t victim = UINT32_MAX;
+    for (uint32_t slot = 0; slot < self->resident_count; slot += 1) {
+      uint32_t index = self->resident[slot];
+      LineBlock *block = &self->blocks[index];
+      bool sealed = index + 1 < self->block_count;
+      if (!sealed || block->data == NULL || block->incompressible) { continue; }
+      hot_count += 1;
+      if (block->pins > 0) { continue; }
+      if (victim == UINT32_MAX || block->last_used < self->blocks[victim].last_used) { victim = index; }
+    }
+    if (hot_count <= LINESTORE_HOT_BLOCKS || victim == UINT32_MAX) {
+      pthread_cond_wait(&self->cold_blocks, &self->mutex);
+      continue;
+    }
+
+    LineBlock *block = &self->blocks[victim];
+    if (!LineBlock_has_copy(block)) { LineStore_compress(self, victim); }
+    // it may have been pinned while the mutex was released
+    if (block->pins > 0 || block->data == NULL || !LineBlock_has_copy(block)) { continue; }
+    char *data = block->data;
+    LineStore_set_memory(self, victim, NULL, block->compressed);
+    LineBlock_free_data(data, block->size);
+  }
+  pthread_mutex_unlock(&self->mutex);
+  return NULL;
+}
+
+// returns a block with room for `length` more bytes after the open line
+// and for its line end, moving the open line into a fresh block when the
+// current one is too small
+static LineBlock *LineStore_reserve(LineStore *self, size_t length) {
+  size_t carried = self->line_is_open ? self->open_line.length : 0;
+  if (self->block_count > 0) {
+    LineBlock *current = &self->blocks[self->block_count - 1];
+    size_t index_bytes = LineBlock_index_bytes(current) + sizeof(uint32_t);
+    if ((size_t)current->used + length + index_bytes <= current->size) { return current; }
+  }
+  if (self->block_count == LINESTORE_MAX_BLOCKS) {
+    fprintf(stderr, "WARN: line store is full, dropping line data\n");
+    return NULL;
+  }
+
+  // NOTE a line that outgrows its block gets a block of twice its size
+  // so that very long lines are only copied a logarithmic number of times
+  size_t needed = carried + length + sizeof(uint32_t);
+  size_t block_size = (needed > LINESTORE_BLOCK_SIZE / 2) ? needed * 2 : LINESTORE_BLOCK_SIZE;
+  if (block_size > UINT32_MAX) { block_size = UINT32_MAX; }
+  // NOTE the line ends have to be aligned
+  block_size &= ~(size_t)(sizeof(uint32_t) - 1);
+  if (needed > block_size) {
+    fprintf(stderr, "WARN: line is longer than 4GiB, truncating it\n");
+    return NULL;
+  }
+  pthread_mutex_lock(&self->mutex);
+  uint32_t index = self->block_count;
+  LineBlock *block = &self->blocks[index];
+  *block = (LineBlock){
+    .data = NULL,
+    .size = block_size,
+    .used = 0,
+    // the open line, if any, becomes the first line of the block
+    .first_line = self->line_count,
+    .line_count = 0,
+  };
+  LineStore_set_memory(self, index, LineBlock_new_data(block_size), NULL);
+  LineStore_touch(self, index);
+
+  if (carried > 0) {
+    LineBlock *previous = &self->blocks[self->open_line.block];
+    memcpy(block->data, previous->data + self->open_line.offset, carried);
+    previous->used = self->open_line.offset;
+    block->used = carried;
+  }
+  self->open_line.block = index;
+  self->open_line.offset = 0;
+  self->block_count += 1;
+
+  // the previous block is sealed now
+  if (self->block_count > 1 && !self->compressor_running && !self->stopping) {
+    int error = pthread_create(&self->compressor, NULL, LineStore_compress_cold, self);
+    if (error == 0) {
+      self->compressor_running = true;
+    }else {
+      fprintf(stderr, "WARN: failed to start the scrollback compressor, keeping it uncompressed -> %s\n", strerror(error));
+      self->stopping = true;
+    }
+  }
+  pthread_cond_signal(&self->cold_blocks);
+  // NOTE the reader does the writing, so a stream that outpaces the
+  // disk is slowed down rather than growing past the budget
+  LineStore_trim(self, true);
+  pthread_mutex_unlock(&self->mutex);
+  return block;
+}
+
+void LineStore_append(LineStore *self, const char *bytes, size_t length) {
+  if (!self->line_is_open) {
+    self->line_is_open = true;
+    self->open_line = (LineSpan){
+      .block = (self->block_count > 0) ? self->block_count - 1 : 0,
+      .offset = (self->block_count > 0) ? self->blocks[self->block_count - 1].used : 0,
+      .length = 0,
+    };
+  }
+  if (length == 0) { return; }
+
+  LineBlock *block = LineStore_reserve(self, length);
+  if (block == NULL) { return; }
+  memcpy(block->data + block->used, bytes, length);
+  block->used += length;
+  self->open_line.length += length;
+}
+
+size_t LineStore_end_line(LineStore *self) {
+  if (!self->line_is_open) { LineStore_append(self, NULL, 0); }
+  // NOTE an empty line may not have a block yet, and the block of any line
+  // may be out of room for its end
+  LineBlock *block = LineStore_reserve(self, 0);
+  self->line_is_open = false;
+  if (block == NULL) { return self->line_count; }
+
+  LineBlock_ends(block)[-1 - (int64_t)block->line_count] = self->open_line.offset + self->open_line.length;
+  block->line_count += 1;
+  self->line_count += 1;
+  return self->line_count - 1;
+}
+
+char *LineStore_tail(LineStore *self, size_t min_length, size_t *available) {
+  LineBlock *block = LineStore_reserve(self, min_length);
+  if (block == NULL) {
+    *available = 0;
+    return NULL;
+  }
+  *available = block->size - block->used - LineBlock_index_bytes(block) - sizeof(uint32_t);
+  return block->data + block->used;
+}
+
+void LineStore_commit_tail(LineStore *self, size_t length) {
+  LineBlock *block = &self->blocks[self->block_count - 1];
+  if (!self->line_is_open) {
+    self->open_line = (LineSpan){ .block = self->block_count - 1, .offset = block->used, .length = 0 };
+  }
+  const char *cursor = block->data + block->used;
+  const char *end = cursor + length;
+  size_t end_offset = end - block->data;
+  const char *newline;
+  while ((newline = scan_byte(cursor, end, '\n')) != NULL) {
+    // NOTE the ends grow down towards the bytes that were read, once the
+    // next one would overwrite them the rest goes through the copying path
+    if (end_offset + LineBlock_index_bytes(block) + sizeof(uint32_t) > block->size) { break; }
+    uint32_t line_end = newline + 1 - block->data;
+    LineBlock_ends(block)[-1 - (int64_t)block->line_count] = line_end;
+    block->line_count += 1;
+    self->line_count += 1;
+    self->open_line = (LineSpan){ .block = self->block_count - 1, .offset = line_end, .length = 0 };
+    cursor = newline + 1;
+  }
+  if (newline == NULL) {
+    block->used = end_offset;
+    self->open_line.length = end_offset - self->open_line.offset;
+    self->line_is_open = self->open_line.length > 0;
+    return;
+  }
+
+  // copied out first, the block they are in is sealed by the appends
+  size_t rest_length = end - cursor;
+  char *rest = malloc(rest_length);
+  memcpy(rest, cursor, rest_length);
+  block->used = cursor - block->data;
+  self->line_is_open = false;
+  const char *rest_cursor = rest, *rest_end = rest + rest_length;
+  while ((newline = scan_byte(rest_cursor, rest_end, '\n')) != NULL) {
+    LineStore_push(self, rest_cursor, newline + 1 - rest_cursor);
+    rest_cursor = newline + 1;
+  }
+  if (rest_cursor < rest_end) { LineStore_append(self, rest_cursor, rest_end - rest_cursor); }
+  free(rest);
+}
+
+size_t LineStore_push(LineStore *self, const char *bytes, size_t length) {
+  LineStore_append(self, bytes, length);
+  return LineStore_end_line(self);
+}
+
+void LineStore_publish(LineStore *self) {
+  // NOTE blocks first, so that a reader that sees a line also sees its block
+  atomic_store_explicit(&self->published_blocks, self->block_count, memory_order_release);
+  atomic_store_explicit(&self->published_lines, self->line_count, memory_order_release);
+}
+
+size_t LineStore_published(LineStore *self) {
+  return atomic_load_explicit(&self->published_lines, memory_order_acquire);
+}
+
+static void LineStore_pin(LineStore *self, uint32_t index) {
+  pthread_mutex_lock(&self->mutex);
+  LineBlock *block = &self->blocks[index];
+  block->pins += 1;
+  LineStore_touch(self, index);
+  if (block->data == NULL) {
+    char *data = LineBlock_new_data(block->size);
+    bool loaded;
+    if (block->compressed_size == 0) {
+      uint32_t index_bytes = LineBlock_index_bytes(block);
+      loaded = read_fully(self->spill_fd, data, block->used, block->spill_offset)
+        && read_fully(self->spill_fd, data + block->size - index_bytes, index_bytes, block->spill_offset + block->used);
+    }else {
+      // NOTE a compressed copy read back from the spill file is only kept
+      // until it is decompressed
+      char *compressed = block->compressed;
+      if (compressed == NULL) {
+        compressed = malloc(block->compressed_size);
+        loaded = read_fully(self->spill_fd, compressed, block->compressed_size, block->spill_offset);
+      }else {
+        loaded = true;
+      }
+      loaded = loaded && LineStore_decompress(block, compressed, data);
+      if (compressed != block->compressed) { free(compressed); }
+    }
+    if (!loaded) {
+      fprintf(stderr, "WARN: failed to read back scrollback -> %s\n", strerror(errno));
+      // every line of the block reads as empty
+      memset(data, 0, block->size);
+    }
+    LineStore_set_memory(self, index, data, block->compressed);
+    LineStore_trim(self, false);
+    pthread_cond_signal(&self->cold_blocks);
+  }
+  pthread_mutex_unlock(&self->mutex);
+}
+
+static void LineStore_unpin(LineStore *self, uint32_t index) {
+  pthread_mutex_lock(&self->mutex);
+  self->blocks[index].pins -= 1;
+  pthread_mutex_unlock(&self->mutex);
+}
+
+// whether line index is in the block, of block_count published blocks
+static bool LineStore_block_has(LineStore *self, uint32_t block, size_t index, uint32_t block_count) {
+  if (index < self->blocks[block].first_line) { return false; }
+  return block + 1 >= block_count || index < self->blocks[block + 1].first_line;
+}
+
+// the last block that starts at or before line index, blocks a long line
+// was carried out of start at the same line as the next one but are empty
+static uint32_t LineStore_find_block(LineStore *self, size_t index, uint32_t block_count) {
+  uint32_t low = 0, high = block_count;
+  while (high - low > 1) {
+    uint32_t middle = low + (high - low) / 2;
+    if (self->blocks[middle].first_line <= index) { low = middle; }else { high = middle; }
+  }
+  return low;
+}
+
+const char *LineStore_get_line(LineStore *self, size_t index, LinePin *pin, size_t *length) {
+  uint32_t block_count = atomic_load_explicit(&self->published_blocks, memory_order_acquire);
+  // consecutive lines mostly share a block, so the pin rarely changes hands
+  if (!pin->held || !LineStore_block_has(self, pin->block, index, block_count)) {
+    uint32_t block = LineStore_find_block(self, index, block_count);
+    if (pin->held) { LineStore_unpin(self, pin->block); }
+    LineStore_pin(self, block);
+    *pin = (LinePin){ .block = block, .held = true };
+  }
+
+  LineBlock *block = &self->blocks[pin->block];
+  int64_t line = index - block->first_line;
+  uint32_t *ends = LineBlock_ends(block);
+  uint32_t start = (line == 0) ? 0 : ends[-line];
+  *length = ends[-1 - line] - start;
+  // NOTE lines read straight into the store keep their newline
+  if (*length > 0 && block->data[start + *length - 1] == '\n') { *length -= 1; }
+  return block->data + start;
+}
+
+void LineStore_release_pin(LineStore *self, LinePin *pin) {
+  if (pin->held) { LineStore_unpin(self, pin->block); }
+  pin->held = false;
+}
+
+void LineStore_free(LineStore *self) {
+  if (self->compressor_running) {
+    pthread_mutex_lock(&self->mutex);
+    self->stopping = true;
+    pthread_cond_signal(&self->cold_blocks);
+    pthread_mutex_unlock(&self->mutex);
+    pthread_join(self->compressor, NULL);
+    self->compressor_running = false;
+  }
+  for (uint32_t i = 0; i < self->block_count; i += 1) {
+    LineBlock_free_data(self->blocks[i].data, self->blocks[i].size);
+    free(self->blocks[i].compressed);
+  }
+  free(self->blocks);
+  free(self->resident);
+  if (self->spill_fd >= 0) { close(self->spill_fd); }
+  pthread_mutex_destroy(&self->mutex);
+  pthread_cond_destroy(&self->cold_blocks);
+  self->block_count = 0;
+}
@@ -0,0 +1,147 @@
+#include "stdint.h"
+#include "stddef.h"
+#include "stdbool.h"
+#include "pthread.h"
+#include "stdatomic.h"
+
+#include "plustypes.h"
+
+#ifndef LINESTORE_H
+#define LINESTORE_H
+
+// lines are packed back to back into blocks of this size, a line
+// that is longer than a block gets a block of its own
+//
+// the end offset of every line in a block is kept at the end of the block,
+// growing down towards the line bytes, so a block carries its own index and
+// evicting it bounds the memory of both
+#define LINESTORE_BLOCK_SIZE (256 * 1024)
+// the block directory is allocated once so that block pointers never
+// move while another thread is reading through them
+#define LINESTORE_MAX_BLOCKS (1 << 16)
+// the most sealed blocks kept uncompressed in memory, the ones being read
+// right now and recently are usually among them
+#define LINESTORE_HOT_BLOCKS 8
+
+// the location of a line inside of a LineStore
+typedef struct {
+  uint32_t block;
+  uint32_t offset;
+  uint32_t length;
+} LineSpan;
+
+// keeps the LineStore block of the lines being read in memory, a reader
+// passes the same pin to every line it gets and releases it when done
+//
+// NOTE a line is only valid until the next line gotten with its pin
+typedef struct {
+  uint32_t block;
+  bool held;
+  // NOTE not used by the store, a merged window keeps which of its sources
+  // the held block belongs to here
+  uint8_t source;
+} LinePin;
+
+#define LINE_PIN_NONE ((LinePin){ .held = false })
+
+typedef struct {
+  // NULL while the block is only kept compressed or in the spill file
+  char *data;
+  // NULL unless a compressed copy of the block is in memory, the copy in
+  // the spill file is compressed too if compressed_size is set
+  char *compressed;
+  uint32_t compressed_size;
+  bool incompressible;
+  uint32_t size;
+  // bytes of line data at the start of the block
+  uint32_t used;
+  // the index of the block's first line in the store and how many of the
+  // line ends at the end of the block are written
+  size_t first_line;
+  uint32_t line_count;
+  // readers using data right now, a pinned block is never evicted
+  uint32_t pins;
+  // the block has been written to the spill file at spill_offset
+  bool spilled;
+  uint64_t spill_offset;
+  // the block last pinned longest ago is evicted first
+  uint64_t last_used;
+} LineBlock;
+
+// an append only arena of line bytes
+//
+// + one allocation per block instead of per line
+// + consecutive lines are adjacent in memory
+// - individual lines can not be freed
+//
+// sealed blocks (every block but the one being appended to) that have not
+// been used recently are compressed by a background thread, keeping only
+// LINESTORE_HOT_BLOCKS of them as they are, a compressed block is
+// decompressed again when it is pinned
+//
+// once the resident blocks outgrow memory_budget, the least recently used
+// sealed blocks are written to an unlinked temp file and freed, they are
+// read back when pinned
+//
+// NOTE the block fields besides data of the last block are guarded by mutex
+typedef struct {
+  LineBlock *blocks;
+  uint32_t block_count;
+  // the line currently being appended to (see LineStore_append)
+  LineSpan open_line;
+  bool line_is_open;
+  // the lines ended so far and how many of them (and of the blocks) other
+  // threads may read, see LineStore_publish
+  size_t line_count;
+  _Atomic size_t published_lines;
+  _Atomic uint32_t published_blocks;
+
+  pthread_mutex_t mutex;
+  // signaled when a block is sealed or decompressed, the compressor is
+  // started with the second block
+  pthread_cond_t cold_blocks;
+  pthread_t compressor;
+  bool compressor_running;
+  bool stopping;
+  // the most bytes of block data to keep in memory, 0 for no limit
+  size_t memory_budget;
+  size_t resident_bytes;
+  // the blocks that have data or a compressed copy in memory, in no
+  // particular order, resident_bytes counts both
+  uint32_t *resident;
+  uint32_t resident_count;
+  uint64_t use_clock;
+  // -1 until the first block is spilled
+  int spill_fd;
+  uint64_t spill_size;
+} LineStore;
+
+// memory_budget of 0 keeps every block in memory
+LineStore LineStore_new(size_t memory_budget);
+// copies bytes onto the end of the open line, opening one if needed,
+// lines of any length can be built up out of several appends
+void LineStore_append(LineStore *self, const char *bytes, size_t length);
+// closes the open line (which may be empty) and returns its index
+size_t LineStore_end_line(LineStore *self);
+// points at the free space after the open line so that a reader can read bytes straight into the store, there is room
+// for at least min_length bytes and available is set to how many fit
+char *LineStore_tail(LineStore *self, size_t min_length, size_t *available);
+// takes length bytes that were written at the tail, ending a line after
+// every newline among them (the newline is kept with the line and left
+// out by LineStore_get_line), the bytes after the last one stay open
+void LineStore_commit_tail(LineStore *self, size_t length);
+// copies a whole line into the store, returning its index
+size_t LineStore_push(LineStore *self, const char *bytes, size_t length);
+// makes every line ended so far visible to other threads in one step
+//
+// NOTE only the thread writing to the store may publish
+void LineStore_publish(LineStore *self);
+// the number of lines that have been published
+size_t LineStore_published(LineStore *self);
+// returns a published line and its length, keeping its block in memory
+// through pin, the block is read back from the spill file if it was evicted
+const char *LineStore_get_line(LineStore *self, size_t index, LinePin *pin, size_t *length);
+void LineStore_release_pin(LineStore *self, LinePin *pin);
+void LineStore_free(LineStore *self);
+
+#endif
@@ -0,0 +1,180 @@
+#include "stdint.h"
+#include "stddef.h"
+#include "string.h"
+#include "stdbool.h"
+
+#include "lz.h"
+
+
+#define LZ_MIN_MATCH 4
+#define LZ_MAX_OFFSET 65535
+#define LZ_HASH_BITS 12
+// the last bytes of the input are always literals, so a match never has to
+// be checked against the end of the input while it is being extended
+#define LZ_LAST_LITERALS 5
+#define LZ_MATCH_LIMIT 12
+// the search skips ahead faster the longer it goes without finding a match
+#define LZ_SKIP_TRIGGER 6
+#define LZ_SHORT_COPY 16
+
+static uint32_t read_u32(const char *at) {
+  uint32_t value;
+  memcpy(&value, at, sizeof(value));
+  return value;
+}
+
+static uint32_t hash_u32(uint32_t value) {
+  return (value * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+// writes the remainder of a length that did not fit in its token nibble
+static char *write_length(char *out, size_t length) {
+  while (length >= 255) {
+    *out++ = (char)255;
+    length -= 255;
+  }
+  *out++ = (char)length;
+  return out;
+}
+
+// writes the literals [literal_start, literal_end) and, unless
+// match_length is 0, a match of match_length bytes at offset back
+static char *write_sequence(
+  char *out, char *out_end,
+  const char *literal_start, const char *literal_end,
+  size_t offset, size_t match_length
+) {
+  size_t literal_length = literal_end - literal_start;
+  // NOTE the worst case: token, both lengths and the offset
+  if ((size_t)(out_end - out) < 1 + literal_length + literal_length / 255 + 1 + 2 + match_length / 255 + 1) {
+    return NULL;
+  }
+  char *token = out++;
+  size_t match_code = (match_length > 0) ? match_length - LZ_MIN_MATCH : 0;
+  *token = (char)(((literal_length < 15 ? literal_length : 15) << 4) | (match_code < 15 ? match_code : 15));
+  if (literal_length >= 15) { out = write_length(out, literal_length - 15); }
+  memcpy(out, literal_start, literal_length);
+  out += literal_length;
+  if (match_length == 0) { return out; }
+
+  *out++ = (char)(offset & 0xff);
+  *out++ = (char)(offset >> 8);
+  if (match_code >= 15) { out = write_length(out, match_code - 15); }
+  return out;
+}
+
+size_t lz_compress(const char *source, size_t length, char *destination, size_t capacity) {
+  char *out = destination;
+  char *out_end = destination + capacity;
+  const char *end = source + length;
+  const char *literal_start = source;
+
+  if (length > LZ_MATCH_LIMIT) {
+    // positions are stored relative to source, an empty slot points at the
+    // start of the input and is verified like any other candidate
+    uint32_t table[1 << LZ_HASH_BITS] = { 0 };
+    const char *match_limit = end - LZ_MATCH_LIMIT;
+    const char *extend_limit = end - LZ_LAST_LITERALS;
+    const char *cursor = source + 1;
+    size_t misses = 1 << LZ_SKIP_TRIGGER;
+
+    while (cursor < match_limit) {
+      uint32_t hash = hash_u32(read_u32(cursor));
+      const char *candidate = source + table[hash];
+      table[hash] = cursor - source;
+      if (cursor - candidate > LZ_MAX_OFFSET || read_u32(candidate) != read_u32(cursor)) {
+        cursor += misses >> LZ_SKIP_TRIGGER;
+        misses += 1;
+        continue;
+      }
+      misses = 1 << LZ_SKIP_TRIGGER;
+
+      // grow the match backwards over literals that also match
+      while (cursor > literal_start && candidate > source && cursor[-1] == candidate[-1]) {
+        cursor -= 1;
+        candidate -= 1;
+      }
+      const char *match_end = cursor + LZ_MIN_MATCH;
+      const char *candidate_end = candidate + LZ_MIN_MATCH;
+      while (match_end < extend_limit && *match_end == *candidate_end) {
+        match_end += 1;
+        candidate_end += 1;
+      }
+
+      out = write_sequence(out, out_end, literal_start, cursor, cursor - candidate, match_end - cursor);
+      if (out == NULL) { return 0; }
+      // the positions inside of the match are skipped except for the last
+      // two, which are often where the next match starts
+      if (match_end - 2 > cursor) {
+        table[hash_u32(read_u32(match_end - 2))] = match_end - 2 - source;
+      }
+      cursor = match_end;
+      literal_start = cursor;
+    }
+  }
+
+  out = write_sequence(out, out_end, literal_start, end, 0, 0);
+  if (out == NULL) { return 0; }
+  return out - destination;
+}
+
+// reads the remainder of a length that did not fit in its token nibble
+static bool read_length(const uint8_t **in, const uint8_t *in_end, size_t *length) {
+  uint8_t byte;
+  do {
+    if (*in >= in_end) { return false; }
+    byte = **in;
+    *in += 1;
+    *length += byte;
+  } while (byte == 255);
+  return true;
+}
+
+bool lz_decompress(const char *source, size_t compressed_length, char *destination, size_t length) {
+  const uint8_t *in = (const uint8_t *)source;
+  const uint8_t *in_end = in + compressed_length;
+  char *out = destination;
+  char *out_end = destination + length;
+
+  while (in < in_end) {
+    uint8_t token = *in++;
+    size_t literal_length = token >> 4;
+    if (literal_length == 15 && !read_length(&in, in_end, &literal_length)) { return false; }
+    if ((size_t)(in_end - in) < literal_length || (size_t)(out_end - out) < literal_length) { return false; }
+    // NOTE most runs are short, a fixed size copy that may write past the
+    // run is much faster than a variable one when there is room for it
+    if (literal_length <= LZ_SHORT_COPY && in_end - in >= LZ_SHORT_COPY && out_end - out >= LZ_SHORT_COPY) {
+      memcpy(out, in, LZ_SHORT_COPY);
+    }else {
+      memcpy(out, in, literal_length);
+    }
+    in += literal_length;
+    out += literal_length;
+    // the last sequence is only literals
+    if (in == in_end) { break; }
+
+    if (in_end - in < 2) { return false; }
+    size_t offset = in[0] | ((size_t)in[1] << 8);
+    in += 2;
+    size_t match_length = token & 15;
+    if (match_length == 15 && !read_length(&in, in_end, &match_length)) { return false; }
+    match_length += LZ_MIN_MATCH;
+    if (offset == 0 || offset > (size_t)(out - destination) || (size_t)(out_end - out) < match_length) {
+      return false;
+    }
+
+    const char *match = out - offset;
+    if (match_length <= LZ_SHORT_COPY && offset >= LZ_SHORT_COPY && out_end - out >= LZ_SHORT_COPY) {
+      memcpy(out, match, LZ_SHORT_COPY);
+      out += match_length;
+    }else if (offset >= match_length) {
+      memcpy(out, match, match_length);
+      out += match_length;
+    }else {
+      // NOTE an overlapping match repeats the last offset bytes
+      for (size_t i = 0; i < match_length; i += 1) { out[i] = match[i]; }
+      out += match_length;
+    }
+  }
+  return out == out_end;
+}
@@ -0,0 +1,22 @@
+#include "stddef.h"
+#include "stdbool.h"
+
+#ifndef LZ_H
+#define LZ_H
+
+// the most bytes lz_compress can produce for length bytes of input
+#define lz_compress_bound(length) ((length) + (length) / 255 + 16)
+
+// compresses [source, source + length) into destination and returns the
+// compressed size, or 0 if it does not fit in capacity bytes
+//
+// NOTE the format is a sequence of literal runs and back references of at
+// least 4 bytes into the previous 64KiB, a token byte holds both lengths
+// and longer ones continue in bytes of 255 (the LZ4 block format)
+size_t lz_compress(const char *source, size_t length, char *destination, size_t capacity);
+
+// decompresses exactly length bytes into destination, returns false if the
+// compressed data is malformed or does not decompress to length bytes
+bool lz_decompress(const char *source, size_t compressed_length, char *destination, size_t length);
+
+#endif
@@ -13,9 +13,12 @@
 #include <pthread.h>
 #include "signal.h"
 #include "sys/wait.h"
+#include "sys/signalfd.h"
+#include "poll.h"
 #include "errno.h"
 
 #include "interface.h"
+#include "search.h"
 
 #include "plustypes.h"
 #include "pt_error.h"
@@ -24,6 +27,12 @@
 enum TokenType {
   TOKEN_HELP,
   TOKEN_SPAWN,
+  TOKEN_FRAME_STATS,
+  TOKEN_FOLLOW,
+  TOKEN_MEMORY_BUDGET,
+  TOKEN_VERTICAL,
+  TOKEN_THROUGHPUT,
+  TOKEN_MERGE,
   TOKEN_STRING,
 };
 
@@ -53,6 +62,30 @@ List_Token lex_command_line_args(char **args, size_t arg_count) {
         List_Token_push(&tokens, (Token) { .type = TOKEN_HELP, .option_content = NULL });
         continue;
       }
+      else if (!strcmp(args[arg_index], "--frame-stats")) {
+        List_Token_push(&tokens, (Token) { .type = TOKEN_FRAME_STATS, .option_content = NULL });
+        continue;
+      }
+      else if (!strcmp(args[arg_index], "--follow")) {
+        List_Token_push(&tokens, (Token) { .type = TOKEN_FOLLOW, .option_content = NULL });
+        continue;
+      }
+      else if (!strcmp(args[arg_index], "--memory-budget")) {
+        List_Token_push(&tokens, (Token) { .type = TOKEN_MEMORY_BUDGET, .option_content = NULL });
+        continue;
+      }
+      else if (!strcmp(args[arg_index], "--vertical")) {
+        List_Token_push(&tokens, (Token) { .type = TOKEN_VERTICAL, .option_content = NULL });
+        continue;
+      }
+      else if (!strcmp(args[arg_index], "--throughput")) {
+        List_Token_push(&tokens, (Token) { .type = TOKEN_THROUGHPUT, .option_content = NULL });
+        continue;
+      }
+      else if (!strcmp(args[arg_index], "--merge")) {
+        List_Token_push(&tokens, (Token) { .type = TOKEN_MERGE, .option_content = NULL });
+        continue;
+      }
       else {
         fprintf(stderr, "unrecognized option %s\n", args[arg_index]);
         List_Token_free(&tokens);
@@ -76,22 +109,25 @@ struct socket_fds {
   pid_t child_id;
 };
 
+// NOTE pipes rather than sockets, the reader enlarges their buffers
+// (see Window_read_blocking) so a fast command is not held up by them
 struct socket_fds spawn_shell_command(char *command) {
   int subproc_stdin_pair[2];
   int subproc_stdout_pair[2];
   int subproc_stderr_pair[2];
 
+  // the command reads from [0] of its stdin pipe and writes to [1] of the others
   expect(
-    (socketpair(PF_LOCAL, SOCK_STREAM, 0, subproc_stdin_pair) >= 0),
-    "failed to create local domain socket"
+    (pipe(subproc_stdin_pair) >= 0),
+    "failed to create pipe"
   );
   expect(
-    (socketpair(PF_LOCAL, SOCK_STREAM, 0, subproc_stdout_pair) >= 0),
-    "failed to create local domain socket"
+    (pipe(subproc_stdout_pair) >= 0),
+    "failed to create pipe"
   );
   expect(
-    (socketpair(PF_LOCAL, SOCK_STREAM, 0, subproc_stderr_pair) >= 0),
-    "failed to create local domain socket"
+    (pipe(subproc_stderr_pair) >= 0),
+    "failed to create pipe"
   )
 
   pid_t process_id;
@@ -100,30 +136,31 @@ struct socket_fds spawn_shell_command(char *command) {
     fprintf(stderr, "Error, failed to fork process -> %s\n", strerror(errno));
     exit(-1);
   }else if (process_id == 0) {
-    // replace stdin stdout and stderr file descriptors with the sockets
-    close(subproc_stdin_pair[0]);
+    // the pager blocks the signals it polls for, the command should not inherit that
+    sigset_t no_signals;
+    sigemptyset(&no_signals);
+    sigprocmask(SIG_SETMASK, &no_signals, NULL);
+
+    // replace stdin stdout and stderr file descriptors with the pipes
+    close(subproc_stdin_pair[1]);
     close(subproc_stdout_pair[0]);
     close(subproc_stderr_pair[0]);
 
-    dup2(subproc_stdin_pair[1], STDIN_FILENO);
+    dup2(subproc_stdin_pair[0], STDIN_FILENO);
     dup2(subproc_stdout_pair[1], STDOUT_FILENO);
     dup2(subproc_stderr_pair[1], STDERR_FILENO);
 
-    stdin = fdopen(subproc_stdin_pair[1], "r");
-    stdout = fdopen(subproc_stdout_pair[1], "w");
-    stderr = fdopen(subproc_stderr_pair[1], "w");
-
     execl("/bin/sh", "/bin/sh", "-c", command, NULL);
     exit(0);
   }
   fprintf(stderr, "DBG: Main process id %i, child id %i\n", getpid(), process_id);
-  // the sockets don't work if you don't close the other end
-  close(subproc_stdin_pair[1]);
+  // the pipes don't see EOF if you don't close the other end
+  close(subproc_stdin_pair[0]);
   close(subproc_stdout_pair[1]);
   close(subproc_stderr_pair[1]);
 
   struct socket_fds structure = {
-    .stdin = subproc_stdin_pair[0],
+    .stdin = subproc_stdin_pair[1],
     .stdout = subproc_stdout_pair[0],
     .stderr = subproc_stderr_pair[0],
     .child_id = process_id
@@ -138,15 +175,45 @@ define_List(int)
 declare_List(pid_t)
 define_List(pid_t)
 
+typedef const char *CString;
+declare_List(CString)
+define_List(CString)
+
 typedef struct {
   List_int file_descriptors;
+  // the file each descriptor was opened from, or NULL
+  List_CString paths;
   List_pid_t children;
+  // the index of the stdout of every spawned command among the file
+  // descriptors, its stderr is the one after it
+  List_int spawned;
+  // the two streams of a spawned command are shown as one merged window
+  bool merge;
+  bool report_frame_stats;
+  bool follow;
+  // frames start out side by side rather than stacked
+  bool vertical;
+  // streams report how fast they were read on stderr
+  bool report_throughput;
+  // how many bytes of lines each stream window keeps in memory before
+  // spilling older ones to disk, 0 for no limit
+  size_t memory_budget;
 } Invocation;
 
+#define DEFAULT_MEMORY_BUDGET_MIB 256
+
 Invocation parse_command_line_arguments(List_Token arg_tokens) {
   Invocation state;
   state.file_descriptors = List_int_new(4);
   state.children = List_pid_t_new(4);
+  state.paths = List_CString_new(4);
+  state.spawned = List_int_new(4);
+  state.merge = false;
+  state.report_frame_stats = false;
+  state.follow = false;
+  state.vertical = false;
+  state.report_throughput = false;
+  state.memory_budget = (size_t)DEFAULT_MEMORY_BUDGET_MIB << 20;
 
   for_range(size_t, index, 0, arg_tokens.item_count) {
     if (arg_tokens.items[index].type == TOKEN_HELP) {
@@ -156,12 +223,44 @@ Invocation parse_command_line_arguments(List_Token arg_tokens) {
 (you may want to downlaod or view help.txt in the github repor at https://github.com/Krayfighter/pager)",
           strerror(errno)
         );
-      }else { List_int_push(&state.file_descriptors, helptxt_fd); }
+      }else {
+        List_int_push(&state.file_descriptors, helptxt_fd);
+        List_CString_push(&state.paths, "help.txt");
+      }
       break;
     }
   }
   for_range(size_t, token_index, 0, arg_tokens.item_count) {
-    if (arg_tokens.items[0].type == TOKEN_SPAWN) {
+    if (arg_tokens.items[token_index].type == TOKEN_FRAME_STATS) {
+      state.report_frame_stats = true;
+    }
+    else if (arg_tokens.items[token_index].type == TOKEN_FOLLOW) {
+      state.follow = true;
+    }
+    else if (arg_tokens.items[token_index].type == TOKEN_VERTICAL) {
+      state.vertical = true;
+    }
+    else if (arg_tokens.items[token_index].type == TOKEN_THROUGHPUT) {
+      state.report_throughput = true;
+    }
+    else if (arg_tokens.items[token_index].type == TOKEN_MERGE) {
+      state.merge = true;
+    }
+    else if (arg_tokens.items[token_index].type == TOKEN_MEMORY_BUDGET) {
+      token_index += 1;
+      Token *budget_token = List_Token_get(&arg_tokens, token_index);
+      char *budget_end = NULL;
+      unsigned long long budget_mib = 0;
+      if (budget_token != NULL && budget_token->type == TOKEN_STRING) {
+        budget_mib = strtoull(budget_token->option_content, &budget_end, 10);
+      }
+      if (budget_end == NULL || *budget_end != '\0') {
+        fprintf(stderr, "Error: expected a number of MiB after --memory-budget\n");
+        exit(-1);
+      }
+      state.memory_budget = (size_t)budget_mib << 20;
+    }
+    else if (arg_tokens.items[token_index].type == TOKEN_SPAWN) {
       token_index += 1;
       Token *command_token = List_Token_get(&arg_tokens, token_index);
       if (command_token == NULL) {
@@ -181,10 +280,13 @@ Invocation parse_command_line_arguments(List_Token arg_tokens) {
         fprintf(stderr, "Error: failed to spawn child shell command -> %s\n", strerror(errno));
         exit(-1);
       }
+      List_int_push(&state.spawned, state.file_descriptors.item_count);
       List_int_push(&state.file_descriptors, child_streams.stdout);
       List_int_push(&state.file_descriptors, child_streams.stderr);
+      List_CString_push(&state.paths, NULL);
+      List_CString_push(&state.paths, NULL);
     }
-    else if (arg_tokens.items[0].type == TOKEN_STRING) {
+    else if (arg_tokens.items[token_index].type == TOKEN_STRING) {
       Token *filename_token = List_Token_get(&arg_tokens, token_index);
       char *filename = filename_token->option_content;
 
@@ -194,6 +296,7 @@ Invocation parse_command_line_arguments(List_Token arg_tokens) {
         exit(-1);
       }
       List_int_push(&state.file_descriptors, file_fd);
+      List_CString_push(&state.paths, filename);
     }
   }
   List_Token_free(&arg_tokens);
@@ -201,12 +304,33 @@ Invocation parse_command_line_arguments(List_Token arg_tokens) {
 }
 
 
+// reaps any children that have exited and drops them from the invocation
+void reap_children(Invocation *appstate) {
+  List_foreach(pid_t, appstate->children, {
+    if (waitpid(*item, NULL, WNOHANG) == *item) {
+      List_pid_t_swapback_delete(&appstate->children, index);
+      index -= 1;
+    }
+  });
+}
+
 int main(int32_t argc, char **argv) {
 
   // save terminal and restore it after main exits
   save_terminal();
   atexit(restore_terminal);
 
+  // these are only ever received through signal_fd in the main loop, they have
+  // to be blocked before any thread or child exists so every thread inherits the mask
+  sigset_t loop_signals;
+  sigemptyset(&loop_signals);
+  sigaddset(&loop_signals, SIGWINCH);
+  sigaddset(&loop_signals, SIGCHLD);
+  pthread_sigmask(SIG_BLOCK, &loop_signals, NULL);
+  install_truncation_handler();
+  int signal_fd = signalfd(-1, &loop_signals, SFD_NONBLOCK | SFD_CLOEXEC);
+  expect((signal_fd >= 0), "Failed to create signalfd for the main loop");
+
   List_Token tokens = lex_command_line_args(argv, argc);
   if (tokens.items == NULL) {
     fprintf(stderr, "Error: Failed to parse command line args (see previous)\n");
@@ -226,6 +350,7 @@ int main(int32_t argc, char **argv) {
     );
 
     List_int_push(&appstate.file_descriptors, piped_input_fd);
+    List_CString_push(&appstate.paths, NULL);
   }
 
   expect(
@@ -234,11 +359,25 @@ int main(int32_t argc, char **argv) {
   );
 
 
-  List_Window windows = List_Window_new(appstate.file_descriptors.item_count);
+  // shared by everything that splits work across the cores
+  Pool *pool = Pool_new(0);
+
+  // NOTE merged windows point at their sources, so the list is never grown
+  size_t merged_count = appstate.merge ? appstate.spawned.item_count : 0;
+  List_Window windows = List_Window_new(appstate.file_descriptors.item_count + merged_count);
   List_foreach(int, appstate.file_descriptors, {
-    List_Window_push(&windows, Window_new(*item));
+    List_Window_push(&windows, Window_new(*item, appstate.paths.items[index], appstate.memory_budget, pool));
   });
+  for_range(size_t, i, 0, appstate.spawned.item_count) {
+    Window *sources[2];
+    sources[0] = &windows.items[appstate.spawned.items[i]];
+    sources[1] = &windows.items[appstate.spawned.items[i] + 1];
+    sources[1]->from_stderr = true;
+    if (appstate.merge) { List_Window_push(&windows, Window_new_merged(sources, 2)); }
+  }
   List_foreach(Window, windows, {
+    if (appstate.follow) { Window_set_following(item, true); }
+    item->report_throughput = appstate.report_throughput;
     Window_spawn_reader(item);
   });
 
@@ -247,41 +386,86 @@ int main(int32_t argc, char **argv) {
 
   Screen screen = (Screen){
     .windows = windows,
-    .top_window = 0,
-    .focus = 0
+    .focus = 0,
+    .vertical = appstate.vertical,
+    .output = OutputBuffer_new(64 * 1024),
+    .report_frame_stats = appstate.report_frame_stats,
+    .search = Search_new(pool, windows.items, windows.item_count),
   };
 
 
   enter_raw_mode();
 
+  Screen_resize(&screen);
   Screen_render(&screen);
 
   fcntl(STDIN_FILENO, F_SETFL, O_NONBLOCK);
 
   // MAINLOOP
+  // NOTE the loop sleeps in poll until the terminal, a reader thread
+  // or a signal has something for it, so an idle pager uses no cpu
+  enum { POLL_STDIN, POLL_SIGNALS, POLL_SEARCH, POLL_WINDOWS };
+  struct pollfd poll_fds[POLL_WINDOWS + windows.item_count];
+  poll_fds[POLL_STDIN] = (struct pollfd){ .fd = STDIN_FILENO, .events = POLLIN };
+  poll_fds[POLL_SIGNALS] = (struct pollfd){ .fd = signal_fd, .events = POLLIN };
+  poll_fds[POLL_SEARCH] = (struct pollfd){ .fd = screen.search->wake_fd, .events = POLLIN };
+  for_range(size_t, i, 0, windows.item_count) {
+    poll_fds[POLL_WINDOWS + i] = (struct pollfd){ .fd = windows.items[i].wake_fd, .events = POLLIN };
+  }
+
   while (1) {
-    // bool needs_redraw = false;
     screen.needs_redraw = false;
 
-    if (Screen_read_stdin(&screen) == INTERFACE_RESULT_QUIT) {
+    if (poll(poll_fds, POLL_WINDOWS + windows.item_count, -1) < 0) {
+      if (errno == EINTR) { continue; }
+      fprintf(stderr, "Error: failed to poll for events -> %s\n", strerror(errno));
       break;
     }
 
-    const size_t MAX_EXPECTED_TERMINAL_ROWS = 200;
+    if (poll_fds[POLL_STDIN].revents & POLLIN) {
+      if (Screen_read_stdin(&screen) == INTERFACE_RESULT_QUIT) {
+        break;
+      }
+    }
+
+    if (poll_fds[POLL_SIGNALS].revents & POLLIN) {
+      struct signalfd_siginfo signal_info;
+      bool resized = false;
+      while (read(signal_fd, &signal_info, sizeof(signal_info)) == sizeof(signal_info)) {
+        if (signal_info.ssi_signo == SIGWINCH) { resized = true; }
+        else if (signal_info.ssi_signo == SIGCHLD) { reap_children(&appstate); }
+      }
+      // NOTE a burst of resizes (dragging the window edge) is one redraw
+      // at the size the terminal ended up with
+      if (resized && Screen_resize(&screen)) { screen.needs_redraw = true; }
+    }
+
+    if (poll_fds[POLL_SEARCH].revents & POLLIN) { Screen_handle_search_wake(&screen); }
+
     List_foreach(Window, windows, {
-      size_t window_lines = item->lines.item_count;
-      screen.needs_redraw |= (Window_update(item) && window_lines < 200);
+      if (!(poll_fds[POLL_WINDOWS + index].revents & POLLIN)) { continue; }
+      Window_acknowledge_wake(item);
+      if (Window_needs_reopen(item)) {
+        Screen_reopen_window(&screen, item);
+        continue;
+      }
+      size_t window_lines = Window_line_count(item);
+      const size_t MAX_EXPECTED_TERMINAL_ROWS = 200;
+      // NOTE a followed window shows its newest lines, so any new line is visible
+      bool visible = window_lines < MAX_EXPECTED_TERMINAL_ROWS || atomic_load(&item->following);
+      // and a window with a jump waiting for the index may be able to land it
+      bool jumping = item->jump.type != WINDOW_JUMP_NONE;
+      // while a file is indexed its progress is shown
+      bool indexing = item->source_type == WINDOW_SOURCE_FILE && !item->fully_indexed;
+      // and a filtered window shows its matches and how far its filter got
+      bool filtering = item->filter != NULL;
+      // NOTE only the frames of this window are drawn again
+      if ((Window_update(item) && (visible || indexing || filtering)) || jumping) { Screen_mark_dirty(&screen, item); }
     });
 
     if (screen.needs_redraw) {
       Screen_render(&screen);
     }
-
-
-    const uint32_t MILLISECOND = 1000;
-    const uint32_t SECOND = 1000 * MILLISECOND;
-    const uint32_t FRAME_TIME = 10 / SECOND;
-    usleep(FRAME_TIME);
   }
 
 
@@ -289,6 +473,8 @@ int main(int32_t argc, char **argv) {
 
   List_foreach(int, appstate.file_descriptors, { close(*item); });
   List_int_free(&appstate.file_descriptors);
+  List_int_free(&appstate.spawned);
+  List_CString_free(&appstate.paths);
 
   if (appstate.children.item_count != 0) {
     List_foreach(pid_t, appstate.children, {
@@ -314,18 +500,37 @@ int main(int32_t argc, char **argv) {
   }
   after_children_killed: {};
 
+  // NOTE file readers index on the pool, so they are stopped before it is
   for (uint8_t window = 0; window < screen.windows.item_count; window += 1) {
     // int result = pthread_kill(screen.windows.items[window].reader_thread, SIGQUIT);
     // if (result != 0) {
     //   fprintf(stderr, "WARN: failed to send signal to thread, %s\n", strerror(errno));
     // }
+    if (screen.windows.items[window].source_type == WINDOW_SOURCE_MERGED) { continue; }
     pthread_t thread_id = screen.windows.items[window].reader_thread;
     pthread_cancel(thread_id);
     pthread_join(thread_id, NULL);
   }
+  // and so are the filters
+  List_foreach(Window, windows, { Window_set_filter(item, NULL, 0); });
+  Search_free(screen.search);
+  Pool_free(pool);
+  close(signal_fd);
 
   List_foreach(Window, windows, { Window_free(item); });
   List_Window_free(&windows);
+  free(screen.frames);
+  free(screen.layout);
+  Canvas_free(&screen.front);
+  Canvas_free(&screen.back);
+  OutputBuffer_free(&screen.output);
+
+  if (screen.report_frame_stats && screen.frame_count > 0) {
+    fprintf(stderr, "STATS: %zu frames, %zu bytes (%zu per frame), %zu syscalls (%.2f per frame)\n",
+      screen.frame_count, screen.total_frame_bytes, screen.total_frame_bytes / screen.frame_count,
+      screen.total_frame_syscalls, (double)screen.total_frame_syscalls / screen.frame_count
+    );
+  }
 
   free_residuals();
 
@@ -0,0 +1,111 @@
+#include "stdint.h"
+#include "stdio.h"
+#include "stdlib.h"
+
+#include "merge.h"
+
+
+Merge *Merge_new(Window **windows, uint8_t window_count) {
+  Merge *self = calloc(1, sizeof(Merge));
+  self->sources = calloc(window_count, sizeof(MergeSource));
+  self->source_count = window_count;
+  for (uint8_t i = 0; i < window_count; i += 1) { self->sources[i].window = windows[i]; }
+  self->entries = SpscList_size_t_new();
+  self->complete = false;
+  return self;
+}
+
+// the time the next line of the source was read, moving past the stamps
+// of the lines already merged
+//
+// NOTE lines without stamps (of a file) go before any that were read
+static uint64_t MergeSource_next_time(MergeSource *self, size_t stamp_count) {
+  if (stamp_count == 0) { return 0; }
+  while (self->stamp_index + 1 < stamp_count
+    && SpscList_at(self->window->stamps, self->stamp_index + 1).first_line <= self->merged_count
+  ) { self->stamp_index += 1; }
+  return SpscList_at(self->window->stamps, self->stamp_index).time;
+}
+
+bool Merge_update(Merge *self) {
+  if (self->complete) { return false; }
+  uint8_t count = self->source_count;
+  size_t available[count], stamp_counts[count];
+  // no line still to come can be older than the limit, which is the oldest
+  // stamp any source may still give a line it has not published yet
+  uint64_t limit = UINT64_MAX;
+  bool ended = true;
+  // NOTE taken before the flags, so a reader seen drained stamps whatever
+  // it reads next after this
+  uint64_t now = line_stamp_now();
+  for (uint8_t i = 0; i < count; i += 1) {
+    Window *window = self->sources[i].window;
+    // NOTE the flags are loaded before the lines, every line published
+    // before they were stored is taken
+    if (window->source_type != WINDOW_SOURCE_STREAM) {
+      ended &= atomic_load(&window->indexed);
+      available[i] = SpscList_size_t_take(&window->line_ends);
+      stamp_counts[i] = 0;
+      continue;
+    }
+    uint64_t watermark = UINT64_MAX;
+    if (!atomic_load(&window->indexed)) {
+      ended = false;
+      // a reader that is not drained is between a read and publishing it,
+      // the lines of that read were stamped at or after its last stamp
+      watermark = atomic_load(&window->drained) ? now : atomic_load(&window->read_stamp);
+    }
+    if (watermark < limit) { limit = watermark; }
+    available[i] = LineStore_published(&window->store);
+    stamp_counts[i] = SpscList_LineStamp_take(&window->stamps);
+  }
+
+  size_t merged = 0;
+  while (true) {
+    // the source whose next line was read first, the first one on a tie
+    uint8_t oldest = count;
+    uint64_t oldest_time = 0;
+    for (uint8_t i = 0; i < count; i += 1) {
+      MergeSource *source = &self->sources[i];
+      if (source->merged_count >= available[i]) { continue; }
+      uint64_t time = MergeSource_next_time(source, stamp_counts[i]);
+      if (oldest == count || time < oldest_time) {
+        oldest = i;
+        oldest_time = time;
+      }
+    }
+    if (oldest == count || oldest_time > limit) { break; }
+
+    // the lines under the same stamp all go before any other source's next
+    // line, so the rest of the run is merged in one go
+    MergeSource *source = &self->sources[oldest];
+    size_t run_end = available[oldest];
+    if (source->stamp_index + 1 < stamp_counts[oldest]) {
+      size_t next_stamp = SpscList_at(source->window->stamps, source->stamp_index + 1).first_line;
+      if (next_stamp < run_end) { run_end = next_stamp; }
+    }
+    for (size_t line = source->merged_count; line < run_end; line += 1) {
+      if (!SpscList_size_t_push(&self->entries, MERGE_ENTRY(oldest, line))) {
+        fprintf(stderr, "WARN: merged index is full, the rest of the lines are not shown\n");
+        SpscList_size_t_publish(&self->entries);
+        self->complete = true;
+        return merged > 0;
+      }
+    }
+    merged += run_end - source->merged_count;
+    source->merged_count = run_end;
+  }
+  SpscList_size_t_publish(&self->entries);
+
+  bool complete = ended;
+  for (uint8_t i = 0; i < count; i += 1) { complete &= self->sources[i].merged_count == available[i]; }
+  bool updated = merged > 0 || complete != self->complete;
+  self->complete = complete;
+  return updated;
+}
+
+void Merge_free(Merge *self) {
+  SpscList_size_t_free(&self->entries);
+  free(self->sources);
+  free(self);
+}
@@ -0,0 +1,45 @@
+#include "stdint.h"
+#include "stddef.h"
+#include "stdbool.h"
+
+#include "interface.h"
+
+#ifndef MERGE_H
+#define MERGE_H
+
+// an entry of a merged window is the line of a source shifted past the
+// bits of the source's index, so the index is one list of plain numbers
+#define MERGE_SOURCE_BITS 8
+#define MERGE_MAX_SOURCES (1 << MERGE_SOURCE_BITS)
+#define MERGE_ENTRY(source, line) (((size_t)(line) << MERGE_SOURCE_BITS) | (source))
+#define MERGE_ENTRY_SOURCE(entry) ((entry) & (MERGE_MAX_SOURCES - 1))
+#define MERGE_ENTRY_LINE(entry) ((entry) >> MERGE_SOURCE_BITS)
+
+typedef struct {
+  Window *window;
+  // the lines of the source merged so far, and the stamp the next one is under
+  size_t merged_count;
+  size_t stamp_index;
+} MergeSource;
+
+// the lines of several windows in the order they were read, without
+// copying any of them (see WINDOW_SOURCE_MERGED)
+//
+// the UI thread merges the lines its sources have published since the last
+// Merge_update, oldest stamp first, and appends them to entries, which other
+// threads (the search and filters) read without locking like a line index
+struct Merge {
+  MergeSource *sources;
+  uint8_t source_count;
+  SpscList_size_t entries;
+  // every source has ended and all of their lines are merged
+  bool complete;
+};
+
+Merge *Merge_new(Window **windows, uint8_t window_count);
+// merges every line that no line still to come from a source can be older
+// than, returns whether there were any
+bool Merge_update(Merge *self);
+void Merge_free(Merge *self);
+
+#endif
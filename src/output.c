@@ -0,0 +1,99 @@
+
+#include "stdint.h"
+#include "stdio.h"
+#include "stdlib.h"
+#include "string.h"
+#include "unistd.h"
+#include "errno.h"
+#include "poll.h"
+
+#include "output.h"
+
+
+OutputBuffer OutputBuffer_new(size_t initial_capacity) {
+  return (OutputBuffer){
+    .bytes = malloc(initial_capacity),
+    .length = 0,
+    .capacity = initial_capacity,
+  };
+}
+
+static void OutputBuffer_reserve(OutputBuffer *self, size_t additional) {
+  if (self->length + additional <= self->capacity) { return; }
+  if (self->capacity == 0) { self->capacity = 4096; }
+  while (self->length + additional > self->capacity) { self->capacity *= 2; }
+  self->bytes = realloc(self->bytes, self->capacity);
+}
+
+void OutputBuffer_push(OutputBuffer *self, const char *bytes, size_t length) {
+  OutputBuffer_reserve(self, length);
+  memcpy(self->bytes + self->length, bytes, length);
+  self->length += length;
+}
+
+void OutputBuffer_push_str(OutputBuffer *self, const char *string) {
+  OutputBuffer_push(self, string, strlen(string));
+}
+
+void OutputBuffer_push_byte(OutputBuffer *self, char byte) {
+  OutputBuffer_reserve(self, 1);
+  self->bytes[self->length] = byte;
+  self->length += 1;
+}
+
+void OutputBuffer_push_uint(OutputBuffer *self, uint32_t value) {
+  char digits[10];
+  size_t digit_count = 0;
+  do {
+    digits[digit_count] = '0' + value % 10;
+    digit_count += 1;
+    value /= 10;
+  } while (value != 0);
+
+  OutputBuffer_reserve(self, digit_count);
+  while (digit_count > 0) {
+    digit_count -= 1;
+    self->bytes[self->length] = digits[digit_count];
+    self->length += 1;
+  }
+}
+
+void OutputBuffer_move_cursor(OutputBuffer *self, uint32_t row, uint32_t col) {
+  OutputBuffer_push(self, "\x1b[", 2);
+  OutputBuffer_push_uint(self, row);
+  OutputBuffer_push_byte(self, ';');
+  OutputBuffer_push_uint(self, col);
+  OutputBuffer_push_byte(self, 'H');
+}
+
+int OutputBuffer_flush(OutputBuffer *self, int fd) {
+  self->flushed_bytes = self->length;
+  self->flush_syscalls = 0;
+
+  size_t written = 0;
+  while (written < self->length) {
+    ssize_t result = write(fd, self->bytes + written, self->length - written);
+    self->flush_syscalls += 1;
+    if (result < 0) {
+      if (errno == EINTR) { continue; }
+      // NOTE the tty may share the O_NONBLOCK flag set on stdin
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        struct pollfd writable = { .fd = fd, .events = POLLOUT };
+        poll(&writable, 1, -1);
+        continue;
+      }
+      fprintf(stderr, "WARN: failed to write frame -> %s\n", strerror(errno));
+      self->length = 0;
+      return -1;
+    }
+    written += result;
+  }
+  self->length = 0;
+  return 0;
+}
+
+void OutputBuffer_free(OutputBuffer *self) {
+  free(self->bytes);
+  self->bytes = NULL;
+  self->length = self->capacity = 0;
+}
@@ -0,0 +1,29 @@
+#include "stdint.h"
+#include "stddef.h"
+
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+// a reusable buffer that a whole frame of escape sequences is composed
+// into, so it can be handed to the terminal with a single write
+typedef struct {
+  char *bytes;
+  size_t length;
+  size_t capacity;
+  // what the most recent OutputBuffer_flush cost
+  size_t flushed_bytes;
+  size_t flush_syscalls;
+} OutputBuffer;
+
+OutputBuffer OutputBuffer_new(size_t initial_capacity);
+void OutputBuffer_push(OutputBuffer *self, const char *bytes, size_t length);
+void OutputBuffer_push_str(OutputBuffer *self, const char *string);
+void OutputBuffer_push_byte(OutputBuffer *self, char byte);
+void OutputBuffer_push_uint(OutputBuffer *self, uint32_t value);
+// NOTE row and col count from 1 like the terminal does
+void OutputBuffer_move_cursor(OutputBuffer *self, uint32_t row, uint32_t col);
+// writes everything to fd and empties the buffer, returns -1 on a write error
+int OutputBuffer_flush(OutputBuffer *self, int fd);
+void OutputBuffer_free(OutputBuffer *self);
+
+#endif
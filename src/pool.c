@@ -0,0 +1,147 @@
+
+#include "stdint.h"
+#include "stdio.h"
+#include "stdlib.h"
+#include "string.h"
+#include "unistd.h"
+#include "pthread.h"
+
+#include "pool.h"
+
+
+typedef struct {
+  Pool *pool;
+  size_t index;
+} PoolWorker;
+
+static bool PoolJob_has_unclaimed(PoolJob *self) {
+  for (size_t i = 0; i < self->slice_count; i += 1) {
+    if (atomic_load_explicit(&self->slices[i].next, memory_order_relaxed) < self->slices[i].end) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// runs tasks from the worker's own slice, then steals from the other slices
+static void PoolJob_work(PoolJob *self, size_t worker_index) {
+  for (size_t offset = 0; offset < self->slice_count; offset += 1) {
+    PoolSlice *slice = &self->slices[(worker_index + offset) % self->slice_count];
+    while (1) {
+      size_t task = atomic_fetch_add_explicit(&slice->next, 1, memory_order_relaxed);
+      if (task >= slice->end) { break; }
+      self->function(self->context, task);
+      atomic_fetch_sub_explicit(&self->remaining, 1, memory_order_acq_rel);
+    }
+  }
+}
+
+static void *Pool_worker(void *args) {
+  PoolWorker *worker = args;
+  Pool *self = worker->pool;
+
+  pthread_mutex_lock(&self->mutex);
+  while (1) {
+    PoolJob *job = NULL;
+    for (size_t i = 0; i < self->job_count; i += 1) {
+      if (PoolJob_has_unclaimed(self->jobs[i])) { job = self->jobs[i]; break; }
+    }
+    if (job == NULL) {
+      if (self->shutting_down) { break; }
+      pthread_cond_wait(&self->work_available, &self->mutex);
+      continue;
+    }
+
+    job->active_workers += 1;
+    pthread_mutex_unlock(&self->mutex);
+    PoolJob_work(job, worker->index);
+    pthread_mutex_lock(&self->mutex);
+    job->active_workers -= 1;
+    if (job->active_workers == 0 && atomic_load(&job->remaining) == 0) {
+      pthread_cond_broadcast(&self->job_done);
+    }
+  }
+  pthread_mutex_unlock(&self->mutex);
+  free(worker);
+  return NULL;
+}
+
+Pool *Pool_new(size_t worker_count) {
+  if (worker_count == 0) {
+    long online_cores = sysconf(_SC_NPROCESSORS_ONLN);
+    worker_count = (online_cores > 0) ? online_cores : 1;
+  }
+  Pool *self = calloc(1, sizeof(Pool));
+  self->threads = calloc(worker_count, sizeof(pthread_t));
+  pthread_mutex_init(&self->mutex, NULL);
+  pthread_cond_init(&self->work_available, NULL);
+  pthread_cond_init(&self->job_done, NULL);
+
+  for (size_t i = 0; i < worker_count; i += 1) {
+    PoolWorker *worker = malloc(sizeof(PoolWorker));
+    *worker = (PoolWorker){ .pool = self, .index = i };
+    if (pthread_create(&self->threads[self->worker_count], NULL, Pool_worker, worker) != 0) {
+      fprintf(stderr, "WARN: failed to start pool worker %zu\n", i);
+      free(worker);
+      continue;
+    }
+    self->worker_count += 1;
+  }
+  return self;
+}
+
+void Pool_run(Pool *self, size_t task_count, PoolTaskFn function, void *context) {
+  if (task_count == 0) { return; }
+  if (self->worker_count == 0) {
+    for (size_t i = 0; i < task_count; i += 1) { function(context, i); }
+    return;
+  }
+
+  // each worker starts on its own contiguous part of the tasks
+  size_t slice_count = (task_count < self->worker_count) ? task_count : self->worker_count;
+  PoolSlice slices[slice_count];
+  for (size_t i = 0; i < slice_count; i += 1) {
+    atomic_init(&slices[i].next, task_count * i / slice_count);
+    slices[i].end = task_count * (i + 1) / slice_count;
+  }
+  PoolJob job = {
+    .function = function,
+    .context = context,
+    .slices = slices,
+    .slice_count = slice_count,
+    .active_workers = 0,
+  };
+  atomic_init(&job.remaining, task_count);
+
+  pthread_mutex_lock(&self->mutex);
+  while (self->job_count == POOL_MAX_JOBS) { pthread_cond_wait(&self->job_done, &self->mutex); }
+  self->jobs[self->job_count] = &job;
+  self->job_count += 1;
+  pthread_cond_broadcast(&self->work_available);
+
+  while (atomic_load(&job.remaining) > 0 || job.active_workers > 0) {
+    pthread_cond_wait(&self->job_done, &self->mutex);
+  }
+  for (size_t i = 0; i < self->job_count; i += 1) {
+    if (self->jobs[i] != &job) { continue; }
+    self->jobs[i] = self->jobs[self->job_count - 1];
+    self->job_count -= 1;
+    break;
+  }
+  // a job slot opened up for anyone waiting on a full pool
+  pthread_cond_broadcast(&self->job_done);
+  pthread_mutex_unlock(&self->mutex);
+}
+
+void Pool_free(Pool *self) {
+  pthread_mutex_lock(&self->mutex);
+  self->shutting_down = true;
+  pthread_cond_broadcast(&self->work_available);
+  pthread_mutex_unlock(&self->mutex);
+  for (size_t i = 0; i < self->worker_count; i += 1) { pthread_join(self->threads[i], NULL); }
+  pthread_mutex_destroy(&self->mutex);
+  pthread_cond_destroy(&self->work_available);
+  pthread_cond_destroy(&self->job_done);
+  free(self->threads);
+  free(self);
+}
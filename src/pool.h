@@ -0,0 +1,53 @@
+#include "stddef.h"
+#include "stdbool.h"
+#include "stdatomic.h"
+#include "pthread.h"
+
+#ifndef POOL_H
+#define POOL_H
+
+// the most jobs that can be running on a pool at the same time
+#define POOL_MAX_JOBS 8
+
+typedef void (*PoolTaskFn)(void *context, size_t task);
+
+// a contiguous range of a job's tasks that starts out belonging to one worker,
+// any worker that runs out of tasks steals from the front of another's slice
+typedef struct {
+  _Atomic size_t next;
+  size_t end;
+} PoolSlice;
+
+typedef struct {
+  PoolTaskFn function;
+  void *context;
+  PoolSlice *slices;
+  size_t slice_count;
+  _Atomic size_t remaining;
+  // workers currently claiming tasks from this job (guarded by the pool mutex)
+  size_t active_workers;
+} PoolJob;
+
+// a fixed set of worker threads (one per core by default) that run the
+// tasks of submitted jobs, balancing the load by stealing tasks
+typedef struct {
+  pthread_t *threads;
+  size_t worker_count;
+  pthread_mutex_t mutex;
+  pthread_cond_t work_available;
+  pthread_cond_t job_done;
+  PoolJob *jobs[POOL_MAX_JOBS];
+  size_t job_count;
+  bool shutting_down;
+} Pool;
+
+// worker_count of 0 means one worker per online core
+Pool *Pool_new(size_t worker_count);
+// runs function(context, task) for every task in [0, task_count) on the workers
+// and returns once all of them are done, tasks near 0 tend to run first
+//
+// NOTE may be called from several threads at once
+void Pool_run(Pool *self, size_t task_count, PoolTaskFn function, void *context);
+void Pool_free(Pool *self);
+
+#endif
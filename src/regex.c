@@ -0,0 +1,631 @@
+#include "stdint.h"
+#include "stdio.h"
+#include "stdlib.h"
+#include "string.h"
+
+#include "regex.h"
+#include "scan.h"
+
+
+static void ByteSet_add_range(ByteSet *self, uint8_t first, uint8_t last) {
+  for (unsigned byte = first; byte <= last; byte += 1) {
+    self->bits[byte >> 6] |= (uint64_t)1 << (byte & 63);
+  }
+}
+
+static bool ByteSet_has(const ByteSet *self, uint8_t byte) {
+  return (self->bits[byte >> 6] >> (byte & 63)) & 1;
+}
+
+// returns the member of a set with exactly one member, or -1
+static int ByteSet_single(const ByteSet *self) {
+  int member = -1;
+  for (int byte = 0; byte < 256; byte += 1) {
+    if (!ByteSet_has(self, byte)) { continue; }
+    if (member >= 0) { return -1; }
+    member = byte;
+  }
+  return member;
+}
+
+
+// PARSING
+// the pattern is parsed into a tree first, so repetitions can copy
+// what they repeat and the required literal can be found
+
+typedef enum {
+  AST_EMPTY,
+  AST_BYTES,
+  AST_CONCAT,
+  AST_ALTERNATE,
+  AST_REPEAT,
+  AST_LINE_START,
+  AST_LINE_END,
+} RegexAstType;
+
+typedef struct {
+  RegexAstType type;
+  uint32_t left, right;
+  uint32_t class;
+  // max of -1 means unbounded
+  int min, max;
+} RegexAst;
+
+typedef struct {
+  const char *pattern;
+  size_t length, position;
+  RegexAst *nodes;
+  size_t node_count, node_size;
+  Regex *regex;
+  const char *error;
+} RegexParser;
+
+static uint32_t RegexParser_node(RegexParser *self, RegexAst node) {
+  if (self->node_count == self->node_size) {
+    self->node_size *= 2;
+    self->nodes = realloc(self->nodes, self->node_size * sizeof(RegexAst));
+  }
+  self->nodes[self->node_count] = node;
+  self->node_count += 1;
+  return self->node_count - 1;
+}
+
+static uint32_t RegexParser_class(RegexParser *self, ByteSet set) {
+  Regex *regex = self->regex;
+  if (regex->class_count == regex->class_size) {
+    regex->class_size *= 2;
+    regex->classes = realloc(regex->classes, regex->class_size * sizeof(ByteSet));
+  }
+  regex->classes[regex->class_count] = set;
+  regex->class_count += 1;
+  return RegexParser_node(self, (RegexAst){ .type = AST_BYTES, .class = regex->class_count - 1 });
+}
+
+static uint32_t RegexParser_range(RegexParser *self, uint8_t first, uint8_t last) {
+  ByteSet set = {0};
+  ByteSet_add_range(&set, first, last);
+  return RegexParser_class(self, set);
+}
+
+static uint32_t RegexParser_concat(RegexParser *self, uint32_t left, uint32_t right) {
+  return RegexParser_node(self, (RegexAst){ .type = AST_CONCAT, .left = left, .right = right });
+}
+
+static uint32_t RegexParser_alternate(RegexParser *self, uint32_t left, uint32_t right) {
+  return RegexParser_node(self, (RegexAst){ .type = AST_ALTERNATE, .left = left, .right = right });
+}
+
+// any UTF-8 sequence of two to four bytes
+static uint32_t RegexParser_multibyte(RegexParser *self) {
+  uint32_t two = RegexParser_concat(self, RegexParser_range(self, 0xc0, 0xdf), RegexParser_range(self, 0x80, 0xbf));
+  uint32_t three = RegexParser_range(self, 0xe0, 0xef);
+  for (int i = 0; i < 2; i += 1) { three = RegexParser_concat(self, three, RegexParser_range(self, 0x80, 0xbf)); }
+  uint32_t four = RegexParser_range(self, 0xf0, 0xf7);
+  for (int i = 0; i < 3; i += 1) { four = RegexParser_concat(self, four, RegexParser_range(self, 0x80, 0xbf)); }
+  return RegexParser_alternate(self, two, RegexParser_alternate(self, three, four));
+}
+
+// a set of ascii bytes or, when negated, every ascii byte not in it and any
+// multibyte UTF-8 sequence
+static uint32_t RegexParser_set(RegexParser *self, ByteSet set, bool negated) {
+  if (!negated) { return RegexParser_class(self, set); }
+  ByteSet ascii = {0};
+  for (int byte = 0; byte < 0x80; byte += 1) {
+    if (!ByteSet_has(&set, byte)) { ByteSet_add_range(&ascii, byte, byte); }
+  }
+  return RegexParser_alternate(self, RegexParser_class(self, ascii), RegexParser_multibyte(self));
+}
+
+static bool RegexParser_at_end(RegexParser *self) { return self->position >= self->length; }
+static char RegexParser_peek(RegexParser *self) { return self->pattern[self->position]; }
+
+static int hex_value(char digit) {
+  if (digit >= '0' && digit <= '9') { return digit - '0'; }
+  if (digit >= 'a' && digit <= 'f') { return digit - 'a' + 10; }
+  if (digit >= 'A' && digit <= 'F') { return digit - 'A' + 10; }
+  return -1;
+}
+
+// reads the escape after a backslash into set, returns true if it
+// is a negated class (\D \W \S)
+static bool RegexParser_escape(RegexParser *self, ByteSet *set) {
+  if (RegexParser_at_end(self)) { self->error = "trailing backslash"; return false; }
+  char escaped = RegexParser_peek(self);
+  self->position += 1;
+  switch (escaped) {
+    case 'd': case 'D': ByteSet_add_range(set, '0', '9'); break;
+    case 'w': case 'W': {
+      ByteSet_add_range(set, '0', '9');
+      ByteSet_add_range(set, 'a', 'z');
+      ByteSet_add_range(set, 'A', 'Z');
+      ByteSet_add_range(set, '_', '_');
+    } break;
+    case 's': case 'S': ByteSet_add_range(set, '\t', '\r'); ByteSet_add_range(set, ' ', ' '); break;
+    case 't': ByteSet_add_range(set, '\t', '\t'); break;
+    case 'n': ByteSet_add_range(set, '\n', '\n'); break;
+    case 'r': ByteSet_add_range(set, '\r', '\r'); break;
+    case 'e': ByteSet_add_range(set, 0x1b, 0x1b); break;
+    case 'b': case 'B': case 'A': case 'z': case 'Z': self->error = "word and text boundaries are not supported"; return false;
+    case 'x': {
+      int high = (self->position + 1 < self->length) ? hex_value(self->pattern[self->position]) : -1;
+      int low = (high >= 0) ? hex_value(self->pattern[self->position + 1]) : -1;
+      if (low < 0) { self->error = "bad \\x escape"; return false; }
+      self->position += 2;
+      ByteSet_add_range(set, high * 16 + low, high * 16 + low);
+    } break;
+    default: ByteSet_add_range(set, escaped, escaped); break;
+  }
+  return escaped == 'D' || escaped == 'W' || escaped == 'S';
+}
+
+// parses a [class] after its opening bracket
+static uint32_t RegexParser_bracket(RegexParser *self) {
+  ByteSet set = {0};
+  bool negated = false;
+  if (!RegexParser_at_end(self) && RegexParser_peek(self) == '^') { negated = true; self->position += 1; }
+
+  bool first = true;
+  while (1) {
+    if (RegexParser_at_end(self)) { self->error = "missing ]"; return 0; }
+    char byte = RegexParser_peek(self);
+    if (byte == ']' && !first) { self->position += 1; break; }
+    first = false;
+    self->position += 1;
+
+    uint8_t range_start = byte;
+    if (byte == '\\') {
+      ByteSet escaped = {0};
+      bool escaped_negated = RegexParser_escape(self, &escaped);
+      if (self->error != NULL) { return 0; }
+      int single = ByteSet_single(&escaped);
+      if (single < 0 || escaped_negated) {
+        // a class escape like \d, which cannot start a range
+        for (int member = 0; member < (escaped_negated ? 0x80 : 256); member += 1) {
+          if (ByteSet_has(&escaped, member) != escaped_negated) { ByteSet_add_range(&set, member, member); }
+        }
+        continue;
+      }
+      range_start = single;
+    }
+
+    uint8_t range_end = range_start;
+    if (self->position + 1 < self->length && RegexParser_peek(self) == '-' && self->pattern[self->position + 1] != ']') {
+      self->position += 1;
+      range_end = RegexParser_peek(self);
+      self->position += 1;
+      if (range_end == '\\') {
+        ByteSet escaped = {0};
+        RegexParser_escape(self, &escaped);
+        if (self->error != NULL) { return 0; }
+        int single = ByteSet_single(&escaped);
+        if (single < 0) { self->error = "bad range in class"; return 0; }
+        range_end = single;
+      }
+      if (range_end < range_start) { self->error = "bad range in class"; return 0; }
+    }
+    ByteSet_add_range(&set, range_start, range_end);
+  }
+  return RegexParser_set(self, set, negated);
+}
+
+static uint32_t RegexParser_alternation(RegexParser *self, int depth);
+
+static uint32_t RegexParser_atom(RegexParser *self, int depth) {
+  char byte = RegexParser_peek(self);
+  self->position += 1;
+  switch (byte) {
+    case '(': {
+      // (?: groups are the same as plain ones, nothing is captured either way
+      if (self->position + 1 < self->length && RegexParser_peek(self) == '?' && self->pattern[self->position + 1] == ':') {
+        self->position += 2;
+      }
+      uint32_t inner = RegexParser_alternation(self, depth + 1);
+      if (self->error != NULL) { return 0; }
+      if (RegexParser_at_end(self) || RegexParser_peek(self) != ')') { self->error = "missing )"; return 0; }
+      self->position += 1;
+      return inner;
+    }
+    case '[': return RegexParser_bracket(self);
+    case '.': return RegexParser_set(self, (ByteSet){0}, true);
+    case '^': return RegexParser_node(self, (RegexAst){ .type = AST_LINE_START });
+    case '$': return RegexParser_node(self, (RegexAst){ .type = AST_LINE_END });
+    case '*': case '+': case '?': self->error = "nothing to repeat"; return 0;
+    case '\\': {
+      ByteSet set = {0};
+      bool negated = RegexParser_escape(self, &set);
+      if (self->error != NULL) { return 0; }
+      return RegexParser_set(self, set, negated);
+    }
+    default: return RegexParser_range(self, byte, byte);
+  }
+}
+
+// reads a decimal number, returns -1 if there is none
+static int RegexParser_number(RegexParser *self) {
+  int number = -1;
+  while (!RegexParser_at_end(self) && RegexParser_peek(self) >= '0' && RegexParser_peek(self) <= '9') {
+    number = ((number < 0) ? 0 : number) * 10 + (RegexParser_peek(self) - '0');
+    if (number > REGEX_MAX_REPEAT) { number = REGEX_MAX_REPEAT + 1; }
+    self->position += 1;
+  }
+  return number;
+}
+
+// parses the {m}, {m,} or {m,n} after an atom
+static bool RegexParser_bounds(RegexParser *self, int *min, int *max) {
+  *min = RegexParser_number(self);
+  *max = *min;
+  if (!RegexParser_at_end(self) && RegexParser_peek(self) == ',') {
+    self->position += 1;
+    *max = RegexParser_number(self);
+  }
+  if (RegexParser_at_end(self) || RegexParser_peek(self) != '}' || *min < 0) {
+    self->error = "bad repetition";
+    return false;
+  }
+  self->position += 1;
+  if (*min > REGEX_MAX_REPEAT || *max > REGEX_MAX_REPEAT || (*max >= 0 && *max < *min)) {
+    self->error = "bad repetition";
+    return false;
+  }
+  return true;
+}
+
+static uint32_t RegexParser_repeat(RegexParser *self, int depth) {
+  uint32_t atom = RegexParser_atom(self, depth);
+  while (self->error == NULL && !RegexParser_at_end(self)) {
+    int min, max;
+    char byte = RegexParser_peek(self);
+    if (byte == '*') { min = 0; max = -1; }
+    else if (byte == '+') { min = 1; max = -1; }
+    else if (byte == '?') { min = 0; max = 1; }
+    else if (byte == '{' && self->position + 1 < self->length
+      && self->pattern[self->position + 1] >= '0' && self->pattern[self->position + 1] <= '9'
+    ) {
+      self->position += 1;
+      if (!RegexParser_bounds(self, &min, &max)) { return 0; }
+      self->position -= 1;
+    }
+    else { break; }
+    self->position += 1;
+    atom = RegexParser_node(self, (RegexAst){ .type = AST_REPEAT, .left = atom, .min = min, .max = max });
+  }
+  return atom;
+}
+
+static uint32_t RegexParser_sequence(RegexParser *self, int depth) {
+  uint32_t sequence = RegexParser_node(self, (RegexAst){ .type = AST_EMPTY });
+  while (self->error == NULL && !RegexParser_at_end(self)) {
+    char byte = RegexParser_peek(self);
+    if (byte == '|' || byte == ')') { break; }
+    sequence = RegexParser_concat(self, sequence, RegexParser_repeat(self, depth));
+  }
+  return sequence;
+}
+
+static uint32_t RegexParser_alternation(RegexParser *self, int depth) {
+  if (depth > 64) { self->error = "groups nested too deeply"; return 0; }
+  uint32_t alternation = RegexParser_sequence(self, depth);
+  while (self->error == NULL && !RegexParser_at_end(self) && RegexParser_peek(self) == '|') {
+    self->position += 1;
+    alternation = RegexParser_alternate(self, alternation, RegexParser_sequence(self, depth));
+  }
+  return alternation;
+}
+
+
+// COMPILING
+// the tree is compiled back to front, each node is given the NFA node
+// that follows it and returns its own entry node
+
+typedef struct {
+  RegexParser *parser;
+  Regex *regex;
+  const char *error;
+} RegexCompiler;
+
+static uint16_t RegexCompiler_node(RegexCompiler *self, RegexNode node) {
+  Regex *regex = self->regex;
+  if (regex->node_count == REGEX_MAX_NODES) {
+    self->error = "pattern too complex";
+    return 0;
+  }
+  regex->nodes[regex->node_count] = node;
+  regex->node_count += 1;
+  return regex->node_count - 1;
+}
+
+static uint16_t RegexCompiler_compile(RegexCompiler *self, uint32_t ast_index, uint16_t out) {
+  if (self->error != NULL) { return 0; }
+  RegexAst ast = self->parser->nodes[ast_index];
+  switch (ast.type) {
+    case AST_EMPTY: return out;
+    case AST_BYTES: return RegexCompiler_node(self, (RegexNode){ .type = REGEX_BYTES, .class = ast.class, .out = out });
+    case AST_LINE_START: return RegexCompiler_node(self, (RegexNode){ .type = REGEX_LINE_START, .out = out });
+    case AST_LINE_END: return RegexCompiler_node(self, (RegexNode){ .type = REGEX_LINE_END, .out = out });
+    case AST_CONCAT: return RegexCompiler_compile(self, ast.left, RegexCompiler_compile(self, ast.right, out));
+    case AST_ALTERNATE: {
+      uint16_t left = RegexCompiler_compile(self, ast.left, out);
+      uint16_t right = RegexCompiler_compile(self, ast.right, out);
+      return RegexCompiler_node(self, (RegexNode){ .type = REGEX_SPLIT, .out = left, .alt = right });
+    }
+    case AST_REPEAT: {
+      uint16_t entry = out;
+      if (ast.max < 0) {
+        // a split that either goes around the loop once more or leaves it
+        uint16_t loop = RegexCompiler_node(self, (RegexNode){ .type = REGEX_SPLIT, .alt = out });
+        uint16_t body = RegexCompiler_compile(self, ast.left, loop);
+        if (self->error != NULL) { return 0; }
+        self->regex->nodes[loop].out = body;
+        entry = loop;
+      }else {
+        // every optional copy may skip straight to out
+        for (int i = ast.min; i < ast.max; i += 1) {
+          uint16_t body = RegexCompiler_compile(self, ast.left, entry);
+          entry = RegexCompiler_node(self, (RegexNode){ .type = REGEX_SPLIT, .out = body, .alt = out });
+        }
+      }
+      for (int i = 0; i < ast.min; i += 1) { entry = RegexCompiler_compile(self, ast.left, entry); }
+      return entry;
+    }
+  }
+  return out;
+}
+
+// collects the bytes of the top level sequence, a run of single bytes
+// that every match contains, and keeps the longest run as the literal
+static void Regex_find_literal(Regex *self, RegexParser *parser, uint32_t ast_index, char *run, size_t *run_length, bool *only_bytes) {
+  RegexAst ast = parser->nodes[ast_index];
+  if (ast.type == AST_EMPTY) { return; }
+  if (ast.type == AST_CONCAT) {
+    Regex_find_literal(self, parser, ast.left, run, run_length, only_bytes);
+    Regex_find_literal(self, parser, ast.right, run, run_length, only_bytes);
+    return;
+  }
+
+  int single = (ast.type == AST_BYTES) ? ByteSet_single(&self->classes[ast.class]) : -1;
+  if (single < 0) {
+    *only_bytes = false;
+    *run_length = 0;
+    return;
+  }
+  // NOTE a run cut off here still filters lines, but the pattern is more than its literal
+  if (*run_length == REGEX_LITERAL_MAX) {
+    *only_bytes = false;
+    return;
+  }
+  run[*run_length] = single;
+  *run_length += 1;
+  if (*run_length > self->literal_length) {
+    memcpy(self->literal, run, *run_length);
+    self->literal_length = *run_length;
+  }
+}
+
+Regex *Regex_compile(const char *pattern, size_t length, const char **error) {
+  Regex *self = calloc(1, sizeof(Regex));
+  self->nodes = calloc(REGEX_MAX_NODES, sizeof(RegexNode));
+  self->class_size = 16;
+  self->classes = malloc(self->class_size * sizeof(ByteSet));
+
+  RegexParser parser = {
+    .pattern = pattern,
+    .length = length,
+    .node_size = 64,
+    .nodes = malloc(64 * sizeof(RegexAst)),
+    .regex = self,
+  };
+  uint32_t root = RegexParser_alternation(&parser, 0);
+  if (parser.error == NULL && !RegexParser_at_end(&parser)) { parser.error = "unmatched )"; }
+
+  RegexCompiler compiler = { .parser = &parser, .regex = self, .error = parser.error };
+  self->match = RegexCompiler_node(&compiler, (RegexNode){ .type = REGEX_MATCH });
+  self->start = RegexCompiler_compile(&compiler, root, self->match);
+
+  if (compiler.error == NULL) {
+    char run[REGEX_LITERAL_MAX];
+    size_t run_length = 0;
+    bool only_bytes = true;
+    Regex_find_literal(self, &parser, root, run, &run_length, &only_bytes);
+    self->is_literal = only_bytes && self->literal_length > 0;
+  }
+  free(parser.nodes);
+
+  if (compiler.error != NULL) {
+    *error = compiler.error;
+    Regex_free(self);
+    return NULL;
+  }
+  return self;
+}
+
+void Regex_free(Regex *self) {
+  free(self->nodes);
+  free(self->classes);
+  free(self);
+}
+
+
+// MATCHING
+
+static int compare_nodes(const void *left, const void *right) {
+  return (int)*(const uint16_t *)left - (int)*(const uint16_t *)right;
+}
+
+// adds node and every node reachable from it without consuming a byte
+// to the scratch set, assertions that do not hold here are dropped (^)
+// or kept for the end of the line ($)
+static void RegexMatcher_add(RegexMatcher *self, uint16_t node, bool at_start, bool at_end) {
+  const RegexNode *nodes = self->regex->nodes;
+  size_t depth = 0;
+  self->stack[depth++] = node;
+  while (depth > 0) {
+    uint16_t current = self->stack[--depth];
+    if (self->marks[current] == self->generation) { continue; }
+    self->marks[current] = self->generation;
+    switch (nodes[current].type) {
+      case REGEX_SPLIT: {
+        self->stack[depth++] = nodes[current].alt;
+        self->stack[depth++] = nodes[current].out;
+      } break;
+      case REGEX_LINE_START: if (at_start) { self->stack[depth++] = nodes[current].out; } break;
+      case REGEX_LINE_END: {
+        if (at_end) { self->stack[depth++] = nodes[current].out; }
+        else { self->scratch[self->scratch_length++] = current; }
+      } break;
+      default: self->scratch[self->scratch_length++] = current; break;
+    }
+  }
+}
+
+static bool RegexMatcher_scratch_has_match(RegexMatcher *self) {
+  for (size_t i = 0; i < self->scratch_length; i += 1) {
+    if (self->scratch[i] == self->regex->match) { return true; }
+  }
+  return false;
+}
+
+static uint32_t hash_nodes(const uint16_t *nodes, size_t count) {
+  uint32_t hash = 2166136261u;
+  for (size_t i = 0; i < count; i += 1) { hash = (hash ^ nodes[i]) * 16777619u; }
+  return hash;
+}
+
+// forgets every state, once the cache is full
+static void RegexMatcher_flush(RegexMatcher *self) {
+  self->state_count = 0;
+  self->flush_count += 1;
+  self->set_items_used = 0;
+  memset(self->table, 0xff, self->table_size * sizeof(int32_t));
+  self->start_state = -1;
+}
+
+// returns the state for the node set in scratch, making it if it is new
+static int32_t RegexMatcher_state(RegexMatcher *self, bool at_start) {
+  qsort(self->scratch, self->scratch_length, sizeof(uint16_t), compare_nodes);
+  uint32_t hash = hash_nodes(self->scratch, self->scratch_length);
+  size_t slot = hash & (self->table_size - 1);
+  // NOTE the start state is left out of the table, ^ holds in it and
+  // it may accept at the end of the line where the same set would not
+  while (!at_start && self->table[slot] >= 0) {
+    RegexDfaState *state = &self->states[self->table[slot]];
+    if (state->set_length == self->scratch_length
+      && memcmp(&self->set_items[state->set_start], self->scratch, self->scratch_length * sizeof(uint16_t)) == 0
+    ) { return self->table[slot]; }
+    slot = (slot + 1) & (self->table_size - 1);
+  }
+
+  if (self->state_count == REGEX_DFA_MAX_STATES) {
+    RegexMatcher_flush(self);
+    return RegexMatcher_state(self, at_start);
+  }
+  if (self->set_items_used + self->scratch_length > self->set_items_size) {
+    while (self->set_items_used + self->scratch_length > self->set_items_size) { self->set_items_size *= 2; }
+    self->set_items = realloc(self->set_items, self->set_items_size * sizeof(uint16_t));
+  }
+
+  int32_t index = self->state_count;
+  RegexDfaState *state = &self->states[index];
+  self->state_count += 1;
+  memset(state->next, 0xff, sizeof(state->next));
+  state->set_start = self->set_items_used;
+  state->set_length = self->scratch_length;
+  memcpy(&self->set_items[state->set_start], self->scratch, self->scratch_length * sizeof(uint16_t));
+  self->set_items_used += self->scratch_length;
+  if (!at_start) { self->table[slot] = index; }
+  state->accepting = RegexMatcher_scratch_has_match(self);
+
+  // whether the $ assertions kept in the set hold at the end of the line
+  self->generation += 1;
+  self->scratch_length = 0;
+  for (size_t i = 0; i < state->set_length; i += 1) {
+    uint16_t node = self->set_items[state->set_start + i];
+    if (self->regex->nodes[node].type == REGEX_LINE_END) { RegexMatcher_add(self, node, at_start, true); }
+  }
+  state->accepting_at_end = state->accepting || RegexMatcher_scratch_has_match(self);
+  return index;
+}
+
+static int32_t RegexMatcher_start(RegexMatcher *self) {
+  if (self->start_state < 0) {
+    self->generation += 1;
+    self->scratch_length = 0;
+    RegexMatcher_add(self, self->regex->start, true, false);
+    self->start_state = RegexMatcher_state(self, true);
+  }
+  return self->start_state;
+}
+
+// the state after state consumes byte, a match may also start after it
+static int32_t RegexMatcher_step(RegexMatcher *self, int32_t state_index, uint8_t byte) {
+  const Regex *regex = self->regex;
+  self->generation += 1;
+  self->scratch_length = 0;
+  RegexDfaState *state = &self->states[state_index];
+  for (size_t i = 0; i < state->set_length; i += 1) {
+    const RegexNode *node = &regex->nodes[self->set_items[state->set_start + i]];
+    if (node->type == REGEX_BYTES && ByteSet_has(&regex->classes[node->class], byte)) {
+      RegexMatcher_add(self, node->out, false, false);
+    }
+  }
+  for (size_t i = 0; i < self->restart_length; i += 1) { RegexMatcher_add(self, self->restart[i], false, false); }
+
+  size_t flushes = self->flush_count;
+  int32_t next = RegexMatcher_state(self, false);
+  // NOTE a flush dropped the state being stepped from, so there is nothing to cache the transition in
+  if (self->flush_count == flushes) { self->states[state_index].next[byte] = next; }
+  return next;
+}
+
+RegexMatcher *RegexMatcher_new(const Regex *regex) {
+  RegexMatcher *self = calloc(1, sizeof(RegexMatcher));
+  self->regex = regex;
+  self->states = malloc(REGEX_DFA_MAX_STATES * sizeof(RegexDfaState));
+  self->set_items_size = 4096;
+  self->set_items = malloc(self->set_items_size * sizeof(uint16_t));
+  self->table_size = REGEX_DFA_MAX_STATES * 2;
+  self->table = malloc(self->table_size * sizeof(int32_t));
+  self->marks = calloc(regex->node_count, sizeof(uint32_t));
+  self->stack = malloc((regex->node_count * 2 + 2) * sizeof(uint16_t));
+  self->scratch = malloc((regex->node_count + 1) * sizeof(uint16_t));
+  RegexMatcher_flush(self);
+
+  // the nodes a match can begin at from anywhere but the start of the line
+  self->generation += 1;
+  self->scratch_length = 0;
+  RegexMatcher_add(self, regex->start, false, false);
+  self->restart = malloc((self->scratch_length + 1) * sizeof(uint16_t));
+  memcpy(self->restart, self->scratch, self->scratch_length * sizeof(uint16_t));
+  self->restart_length = self->scratch_length;
+  return self;
+}
+
+bool RegexMatcher_matches(RegexMatcher *self, const char *data, size_t length) {
+  const Regex *regex = self->regex;
+  if (regex->literal_length > 0) {
+    bool found = scan_substring(data, data + length, regex->literal, regex->literal_length) != NULL;
+    if (!found || regex->is_literal) { return found; }
+  }
+
+  int32_t state = RegexMatcher_start(self);
+  for (size_t i = 0; i < length; i += 1) {
+    if (self->states[state].accepting) { return true; }
+    // no node left to match with, nothing later in the line can start one either
+    if (self->states[state].set_length == 0) { return false; }
+    int32_t next = self->states[state].next[(uint8_t)data[i]];
+    if (next < 0) { next = RegexMatcher_step(self, state, data[i]); }
+    state = next;
+  }
+  return self->states[state].accepting_at_end;
+}
+
+void RegexMatcher_free(RegexMatcher *self) {
+  free(self->states);
+  free(self->set_items);
+  free(self->table);
+  free(self->marks);
+  free(self->stack);
+  free(self->scratch);
+  free(self->restart);
+  free(self);
+}
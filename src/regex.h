@@ -0,0 +1,101 @@
+#include "stdint.h"
+#include "stddef.h"
+#include "stdbool.h"
+
+#ifndef REGEX_H
+#define REGEX_H
+
+// the most NFA nodes a pattern may compile to, repetition counts multiply
+// the nodes of what they repeat so this bounds patterns like (a{100}){100}
+#define REGEX_MAX_NODES 4096
+#define REGEX_MAX_REPEAT 255
+#define REGEX_LITERAL_MAX 256
+// the most DFA states a matcher caches before it starts over
+#define REGEX_DFA_MAX_STATES 1024
+
+// a set of bytes, one bit each
+typedef struct {
+  uint64_t bits[4];
+} ByteSet;
+
+typedef enum {
+  // consumes one byte in classes[class] and continues at out
+  REGEX_BYTES,
+  // continues at both out and alt
+  REGEX_SPLIT,
+  // continue at out only at the start (or end) of the line
+  REGEX_LINE_START,
+  REGEX_LINE_END,
+  REGEX_MATCH,
+} RegexNodeType;
+
+typedef struct {
+  uint8_t type;
+  uint16_t class;
+  uint16_t out, alt;
+} RegexNode;
+
+// a compiled pattern: a Thompson NFA over bytes and the longest literal
+// that every match has to contain
+//
+// supports literals, ., [classes] with ranges and negation, \d \w \s (and
+// their negations), ^, $, (groups), |, *, +, ? and {m,n}
+//
+// NOTE . and negated classes match a whole UTF-8 sequence, other classes
+// match single bytes
+typedef struct {
+  RegexNode *nodes;
+  size_t node_count;
+  ByteSet *classes;
+  size_t class_count, class_size;
+  uint16_t start, match;
+  // lines that do not contain literal cannot match
+  char literal[REGEX_LITERAL_MAX];
+  size_t literal_length;
+  // the whole pattern is literal, so finding it is enough
+  bool is_literal;
+} Regex;
+
+typedef struct {
+  int32_t next[256];
+  uint32_t set_start, set_length;
+  bool accepting, accepting_at_end;
+} RegexDfaState;
+
+// the lazily built DFA of a Regex: a state is the set of NFA nodes the
+// line could be in, transitions are computed the first time they are taken
+// and cached, so the cost of a byte is a table lookup once the cache is warm
+//
+// NOTE a matcher is used by one thread at a time, the Regex can be shared
+typedef struct {
+  const Regex *regex;
+  RegexDfaState *states;
+  size_t state_count;
+  uint16_t *set_items;
+  size_t set_items_used, set_items_size;
+  // open addressing over the states by their node sets
+  int32_t *table;
+  size_t table_size;
+  int32_t start_state;
+  size_t flush_count;
+  // scratch space for building a node set
+  uint32_t *marks;
+  uint32_t generation;
+  uint16_t *stack;
+  uint16_t *scratch;
+  size_t scratch_length;
+  // the nodes every position of the line may start a match from
+  uint16_t *restart;
+  size_t restart_length;
+} RegexMatcher;
+
+// returns NULL and points error at a message if pattern is invalid
+Regex *Regex_compile(const char *pattern, size_t length, const char **error);
+void Regex_free(Regex *self);
+
+RegexMatcher *RegexMatcher_new(const Regex *regex);
+// true if any part of the line matches, in time linear in its length
+bool RegexMatcher_matches(RegexMatcher *self, const char *data, size_t length);
+void RegexMatcher_free(RegexMatcher *self);
+
+#endif
@@ -0,0 +1,169 @@
+
+#include "stdint.h"
+#include "stddef.h"
+#include "string.h"
+
+#include "scan.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include "immintrin.h"
+#define SCAN_X86
+#endif
+
+
+#define WORD_ONES (~(uint64_t)0 / 0xff)
+#define WORD_HIGHS (WORD_ONES * 0x80)
+// nonzero when any byte of word is zero
+#define word_has_zero_byte(word) (((word) - WORD_ONES) & ~(word) & WORD_HIGHS)
+
+static const char *scan_byte_scalar(const char *cursor, const char *end, char byte) {
+  // byte at a time until the cursor is word aligned
+  while (cursor < end && ((uintptr_t)cursor & (sizeof(uint64_t) - 1))) {
+    if (*cursor == byte) { return cursor; }
+    cursor += 1;
+  }
+  uint64_t pattern = WORD_ONES * (uint8_t)byte;
+  while (end - cursor >= (ptrdiff_t)sizeof(uint64_t)) {
+    uint64_t word;
+    memcpy(&word, cursor, sizeof(word));
+    if (word_has_zero_byte(word ^ pattern)) { break; }
+    cursor += sizeof(uint64_t);
+  }
+  while (cursor < end) {
+    if (*cursor == byte) { return cursor; }
+    cursor += 1;
+  }
+  return NULL;
+}
+
+static const char *scan_substring_scalar(
+  const char *cursor, const char *end, const char *needle, size_t needle_length
+) {
+  const char *last_start = end - needle_length;
+  while (cursor <= last_start) {
+    cursor = scan_byte_scalar(cursor, last_start + 1, needle[0]);
+    if (cursor == NULL) { return NULL; }
+    if (cursor[needle_length - 1] == needle[needle_length - 1]
+      && memcmp(cursor + 1, needle + 1, needle_length - 2) == 0
+    ) { return cursor; }
+    cursor += 1;
+  }
+  return NULL;
+}
+
+// checks every candidate position in mask (one bit per byte from cursor)
+#define verify_candidates(mask, cursor, needle, needle_length) \
+while (mask != 0) { \
+  const char *candidate = cursor + __builtin_ctz(mask); \
+  if (memcmp(candidate + 1, needle + 1, needle_length - 2) == 0) { return candidate; } \
+  mask &= mask - 1; \
+}
+
+#ifdef SCAN_X86
+
+#ifdef __SSE2__
+static const char *scan_byte_sse2(const char *cursor, const char *end, char byte) {
+  __m128i needle = _mm_set1_epi8(byte);
+  while (end - cursor >= 16) {
+    __m128i chunk = _mm_loadu_si128((const __m128i *)cursor);
+    uint32_t mask = _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, needle));
+    if (mask != 0) { return cursor + __builtin_ctz(mask); }
+    cursor += 16;
+  }
+  return scan_byte_scalar(cursor, end, byte);
+}
+static const char *scan_substring_sse2(
+  const char *cursor, const char *end, const char *needle, size_t needle_length
+) {
+  __m128i first = _mm_set1_epi8(needle[0]);
+  __m128i last = _mm_set1_epi8(needle[needle_length - 1]);
+  while (end - cursor >= (ptrdiff_t)(needle_length - 1 + 16)) {
+    __m128i first_chunk = _mm_loadu_si128((const __m128i *)cursor);
+    __m128i last_chunk = _mm_loadu_si128((const __m128i *)(cursor + needle_length - 1));
+    uint32_t mask = _mm_movemask_epi8(_mm_and_si128(
+      _mm_cmpeq_epi8(first_chunk, first), _mm_cmpeq_epi8(last_chunk, last)
+    ));
+    verify_candidates(mask, cursor, needle, needle_length);
+    cursor += 16;
+  }
+  return scan_substring_scalar(cursor, end, needle, needle_length);
+}
+#endif
+
+__attribute__((target("avx2")))
+static const char *scan_substring_avx2(
+  const char *cursor, const char *end, const char *needle, size_t needle_length
+) {
+  __m256i first = _mm256_set1_epi8(needle[0]);
+  __m256i last = _mm256_set1_epi8(needle[needle_length - 1]);
+  while (end - cursor >= (ptrdiff_t)(needle_length - 1 + 32)) {
+    __m256i first_chunk = _mm256_loadu_si256((const __m256i *)cursor);
+    __m256i last_chunk = _mm256_loadu_si256((const __m256i *)(cursor + needle_length - 1));
+    uint32_t mask = _mm256_movemask_epi8(_mm256_and_si256(
+      _mm256_cmpeq_epi8(first_chunk, first), _mm256_cmpeq_epi8(last_chunk, last)
+    ));
+    verify_candidates(mask, cursor, needle, needle_length);
+    cursor += 32;
+  }
+  return scan_substring_scalar(cursor, end, needle, needle_length);
+}
+
+__attribute__((target("avx2")))
+static const char *scan_byte_avx2(const char *cursor, const char *end, char byte) {
+  __m256i needle = _mm256_set1_epi8(byte);
+  // two vectors per iteration to keep both load ports busy on long lines
+  while (end - cursor >= 64) {
+    __m256i low = _mm256_loadu_si256((const __m256i *)cursor);
+    __m256i high = _mm256_loadu_si256((const __m256i *)(cursor + 32));
+    uint32_t low_mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(low, needle));
+    uint32_t high_mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(high, needle));
+    if ((low_mask | high_mask) != 0) {
+      if (low_mask != 0) { return cursor + __builtin_ctz(low_mask); }
+      return cursor + 32 + __builtin_ctz(high_mask);
+    }
+    cursor += 64;
+  }
+  while (end - cursor >= 32) {
+    __m256i chunk = _mm256_loadu_si256((const __m256i *)cursor);
+    uint32_t mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, needle));
+    if (mask != 0) { return cursor + __builtin_ctz(mask); }
+    cursor += 32;
+  }
+  return scan_byte_scalar(cursor, end, byte);
+}
+
+#endif
+
+typedef const char *(*ScanByteFn)(const char *, const char *, char);
+typedef const char *(*ScanSubstringFn)(const char *, const char *, const char *, size_t);
+
+static ScanByteFn scan_byte_implementation = scan_byte_scalar;
+static ScanSubstringFn scan_substring_implementation = scan_substring_scalar;
+
+// picks the widest implementations before main (and any reader thread) runs
+__attribute__((constructor))
+static void select_scan_implementations() {
+#ifdef SCAN_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    scan_byte_implementation = scan_byte_avx2;
+    scan_substring_implementation = scan_substring_avx2;
+    return;
+  }
+#ifdef __SSE2__
+  scan_byte_implementation = scan_byte_sse2;
+  scan_substring_implementation = scan_substring_sse2;
+#endif
+#endif
+}
+
+const char *scan_byte(const char *start, const char *end, char byte) {
+  return scan_byte_implementation(start, end, byte);
+}
+
+const char *scan_substring(const char *start, const char *end, const char *needle, size_t needle_length) {
+  if (needle_length == 0) { return start; }
+  if ((size_t)(end - start) < needle_length) { return NULL; }
+  if (needle_length == 1) { return scan_byte(start, end, needle[0]); }
+  return scan_substring_implementation(start, end, needle, needle_length);
+}
@@ -0,0 +1,20 @@
+#include "stddef.h"
+
+#ifndef SCAN_H
+#define SCAN_H
+
+// returns a pointer to the first occurrence of byte in [start, end)
+// or NULL if there is none
+//
+// NOTE uses AVX2 or SSE2 when the cpu supports them and falls back to
+// scanning a machine word at a time otherwise
+const char *scan_byte(const char *start, const char *end, char byte);
+
+// returns a pointer to the first occurrence of needle in [start, end)
+// or NULL if there is none
+//
+// NOTE candidates are found by comparing the first and last byte of the
+// needle a vector at a time and only those are verified with memcmp
+const char *scan_substring(const char *start, const char *end, const char *needle, size_t needle_length);
+
+#endif
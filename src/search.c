@@ -0,0 +1,400 @@
+#include "stdint.h"
+#include "stdio.h"
+#include "stdlib.h"
+#include "string.h"
+#include "unistd.h"
+#include "errno.h"
+#include "pthread.h"
+#include "sys/eventfd.h"
+
+#include "search.h"
+
+
+define_List(size_t)
+
+// how many lines are scanned between checks for cancelation
+#define SEARCH_CHECK_INTERVAL 4096
+
+Search *Search_new(Pool *pool, Window *windows, size_t window_count) {
+  Search *self = calloc(1, sizeof(Search));
+  self->pool = pool;
+  self->window_count = window_count;
+  self->windows = calloc(window_count, sizeof(WindowMatches));
+  for (size_t i = 0; i < window_count; i += 1) {
+    self->windows[i] = (WindowMatches){
+      .window = &windows[i],
+      .lines = List_size_t_new(16),
+      .indexed_count = 0,
+    };
+  }
+  pthread_mutex_init(&self->resolve_mutex, NULL);
+  pthread_mutex_init(&self->matcher_mutex, NULL);
+  self->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (self->wake_fd < 0) {
+    fprintf(stderr, "WARN: failed to create search eventfd -> %s\n", strerror(errno));
+  }
+  atomic_init(&self->result, SEARCH_NOT_FOUND);
+  self->result_delivered = true;
+  return self;
+}
+
+bool Search_line_matches(RegexMatcher *matcher, LineView line) {
+  return RegexMatcher_matches(matcher, line.data, line.length);
+}
+
+static RegexMatcher *Search_take_matcher(Search *self) {
+  RegexMatcher *matcher = NULL;
+  pthread_mutex_lock(&self->matcher_mutex);
+  if (self->matcher_count > 0) {
+    self->matcher_count -= 1;
+    matcher = self->matchers[self->matcher_count];
+  }
+  pthread_mutex_unlock(&self->matcher_mutex);
+  return (matcher != NULL) ? matcher : RegexMatcher_new(self->regex);
+}
+
+static void Search_return_matcher(Search *self, RegexMatcher *matcher) {
+  pthread_mutex_lock(&self->matcher_mutex);
+  if (self->matcher_count == self->matcher_size) {
+    self->matcher_size = (self->matcher_size == 0) ? 8 : self->matcher_size * 2;
+    self->matchers = realloc(self->matchers, self->matcher_size * sizeof(RegexMatcher *));
+  }
+  self->matchers[self->matcher_count] = matcher;
+  self->matcher_count += 1;
+  pthread_mutex_unlock(&self->matcher_mutex);
+}
+
+// drops the compiled pattern along with the matchers built for it
+static void Search_free_regex(Search *self) {
+  for (size_t i = 0; i < self->matcher_count; i += 1) { RegexMatcher_free(self->matchers[i]); }
+  self->matcher_count = 0;
+  if (self->regex != NULL) { Regex_free(self->regex); }
+  self->regex = NULL;
+}
+
+// the first index in lines holding a line >= line
+static size_t lower_bound(List_size_t *lines, size_t line) {
+  size_t low = 0, high = lines->item_count;
+  while (low < high) {
+    size_t middle = low + (high - low) / 2;
+    if (lines->items[middle] < line) { low = middle + 1; }
+    else { high = middle; }
+  }
+  return low;
+}
+
+static void Search_publish(Search *self, int64_t result) {
+  atomic_store_explicit(&self->result, result, memory_order_release);
+  eventfd_write(self->wake_fd, 1);
+}
+
+// answers the request from the index and the chunks finished so far, if
+// the chunks it depends on are all done (call with resolve_mutex held)
+//
+// NOTE the target window's chunks are contiguous and in line order
+static void Search_resolve_locked(Search *self) {
+  if (atomic_load_explicit(&self->result, memory_order_relaxed) != SEARCH_PENDING) { return; }
+  WindowMatches *target = &self->windows[self->target];
+  size_t first_chunk = 0;
+  while (first_chunk < self->chunk_count && self->chunks[first_chunk].window != self->target) { first_chunk += 1; }
+  size_t end_chunk = first_chunk;
+  while (end_chunk < self->chunk_count && self->chunks[end_chunk].window == self->target) { end_chunk += 1; }
+
+  switch (self->request) {
+    case SEARCH_REQUEST_NEXT: {
+      if (self->direction == SEARCH_FORWARD) {
+        size_t found = lower_bound(&target->lines, self->from_line);
+        if (found < target->lines.item_count) { Search_publish(self, target->lines.items[found]); return; }
+        for (size_t i = first_chunk; i < end_chunk; i += 1) {
+          SearchChunk *chunk = &self->chunks[i];
+          if (chunk->end_line <= self->from_line) { continue; }
+          if (!atomic_load_explicit(&chunk->done, memory_order_acquire)) { return; }
+          found = lower_bound(&chunk->matches, self->from_line);
+          if (found < chunk->matches.item_count) { Search_publish(self, chunk->matches.items[found]); return; }
+        }
+      }else {
+        for (size_t i = end_chunk; i > first_chunk; i -= 1) {
+          SearchChunk *chunk = &self->chunks[i - 1];
+          if (chunk->first_line > self->from_line) { continue; }
+          if (!atomic_load_explicit(&chunk->done, memory_order_acquire)) { return; }
+          size_t found = lower_bound(&chunk->matches, self->from_line + 1);
+          if (found > 0) { Search_publish(self, chunk->matches.items[found - 1]); return; }
+        }
+        size_t found = lower_bound(&target->lines, self->from_line + 1);
+        if (found > 0) { Search_publish(self, target->lines.items[found - 1]); return; }
+      }
+      Search_publish(self, SEARCH_NOT_FOUND);
+    } break;
+    case SEARCH_REQUEST_NTH: {
+      if (self->nth <= target->lines.item_count) { Search_publish(self, target->lines.items[self->nth - 1]); return; }
+      size_t seen = target->lines.item_count;
+      for (size_t i = first_chunk; i < end_chunk; i += 1) {
+        SearchChunk *chunk = &self->chunks[i];
+        if (!atomic_load_explicit(&chunk->done, memory_order_acquire)) { return; }
+        if (self->nth <= seen + chunk->matches.item_count) {
+          Search_publish(self, chunk->matches.items[self->nth - seen - 1]);
+          return;
+        }
+        seen += chunk->matches.item_count;
+      }
+      Search_publish(self, SEARCH_NOT_FOUND);
+    } break;
+    case SEARCH_REQUEST_COUNT: {
+      // counts are read from the index once the job is merged into it
+      if (self->chunk_count == 0) { Search_publish(self, Search_total_match_count(self)); }
+    } break;
+  }
+}
+
+static void Search_resolve(Search *self) {
+  pthread_mutex_lock(&self->resolve_mutex);
+  Search_resolve_locked(self);
+  pthread_mutex_unlock(&self->resolve_mutex);
+}
+
+static void Search_scan_chunk(void *context, size_t task) {
+  Search *self = context;
+  SearchChunk *chunk = &self->chunks[self->chunk_order[task]];
+  Window *window = self->windows[chunk->window].window;
+  RegexMatcher *matcher = Search_take_matcher(self);
+  LinePin pin = LINE_PIN_NONE;
+
+  bool canceled = false;
+  for (size_t line = chunk->first_line; line < chunk->end_line; line += 1) {
+    if ((line - chunk->first_line) % SEARCH_CHECK_INTERVAL == 0
+      && atomic_load_explicit(&self->cancel, memory_order_relaxed)
+    ) {
+      canceled = true;
+      break;
+    }
+    if (Search_line_matches(matcher, Window_get_line(window, line, &pin))) {
+      List_size_t_push(&chunk->matches, line);
+    }
+  }
+  Window_release_pin(window, &pin);
+  Search_return_matcher(self, matcher);
+  if (canceled) { return; }
+  atomic_fetch_add_explicit(&self->lines_scanned, chunk->end_line - chunk->first_line, memory_order_relaxed);
+  atomic_store_explicit(&chunk->done, true, memory_order_release);
+  Search_resolve(self);
+}
+
+// appends the finished chunks to their windows' indexes
+static void Search_merge_chunks(Search *self) {
+  for (size_t i = 0; i < self->chunk_count; i += 1) {
+    SearchChunk *chunk = &self->chunks[i];
+    WindowMatches *matches = &self->windows[chunk->window];
+    List_size_t_pushall(&matches->lines, &chunk->matches);
+    matches->indexed_count = chunk->end_line;
+  }
+}
+
+static void Search_free_chunks(Search *self) {
+  for (size_t i = 0; i < self->chunk_count; i += 1) {
+    List_size_t_free(&self->chunks[i].matches);
+  }
+  free(self->chunks);
+  free(self->chunk_order);
+  self->chunks = NULL;
+  self->chunk_order = NULL;
+  self->chunk_count = 0;
+}
+
+static void *Search_run(void *args) {
+  Search *self = args;
+  Pool_run(self->pool, self->chunk_count, Search_scan_chunk, self);
+
+  pthread_mutex_lock(&self->resolve_mutex);
+  // NOTE a canceled job's chunks are incomplete, so they are thrown away
+  bool canceled = atomic_load(&self->cancel);
+  if (!canceled) { Search_merge_chunks(self); }
+  Search_free_chunks(self);
+  if (!canceled) { Search_resolve_locked(self); }
+  pthread_mutex_unlock(&self->resolve_mutex);
+
+  atomic_store(&self->finished, true);
+  eventfd_write(self->wake_fd, 1);
+  return NULL;
+}
+
+// splits the lines of every window that are not indexed yet into chunks,
+// ordered so the chunks the request depends on are scanned first
+static void Search_plan_chunks(Search *self) {
+  size_t chunk_count = 0;
+  size_t line_counts[self->window_count];
+  for (size_t i = 0; i < self->window_count; i += 1) {
+    // lines below the UI thread's count are immutable, so the pool
+    // can read them without synchronizing with the reader
+    line_counts[i] = Window_line_count(self->windows[i].window);
+    // NOTE the lines of hidden windows are searched through their merged window
+    if (self->windows[i].window->hidden) { line_counts[i] = self->windows[i].indexed_count; }
+    size_t pending = line_counts[i] - self->windows[i].indexed_count;
+    chunk_count += (pending + SEARCH_CHUNK_LINES - 1) / SEARCH_CHUNK_LINES;
+  }
+  if (chunk_count == 0) { return; }
+
+  self->chunks = calloc(chunk_count, sizeof(SearchChunk));
+  self->chunk_order = calloc(chunk_count, sizeof(size_t));
+  self->chunk_count = chunk_count;
+
+  size_t next_chunk = 0, first_chunk = 0, end_chunk = 0;
+  for (size_t i = 0; i < self->window_count; i += 1) {
+    if (i == self->target) { first_chunk = next_chunk; }
+    for (size_t line = self->windows[i].indexed_count; line < line_counts[i]; line += SEARCH_CHUNK_LINES) {
+      size_t end_line = line + SEARCH_CHUNK_LINES;
+      if (end_line > line_counts[i]) { end_line = line_counts[i]; }
+      SearchChunk *chunk = &self->chunks[next_chunk];
+      chunk->window = i;
+      chunk->first_line = line;
+      chunk->end_line = end_line;
+      chunk->matches = List_size_t_new(16);
+      atomic_init(&chunk->done, false);
+      next_chunk += 1;
+    }
+    if (i == self->target) { end_chunk = next_chunk; }
+  }
+
+  // the target's chunks go first, starting at from_line and heading
+  // in the search direction before wrapping around to the rest
+  size_t order = 0;
+  size_t start = first_chunk;
+  if (self->request == SEARCH_REQUEST_NEXT) {
+    while (start + 1 < end_chunk && self->chunks[start].end_line <= self->from_line) { start += 1; }
+  }
+  if (self->request == SEARCH_REQUEST_NEXT && self->direction == SEARCH_BACKWARD) {
+    for (size_t i = start + 1; i > first_chunk; i -= 1) { self->chunk_order[order++] = i - 1; }
+    for (size_t i = start + 1; i < end_chunk; i += 1) { self->chunk_order[order++] = i; }
+  }else {
+    for (size_t i = start; i < end_chunk; i += 1) { self->chunk_order[order++] = i; }
+    for (size_t i = first_chunk; i < start; i += 1) { self->chunk_order[order++] = i; }
+  }
+  for (size_t i = 0; i < chunk_count; i += 1) {
+    if (i < first_chunk || i >= end_chunk) { self->chunk_order[order++] = i; }
+  }
+}
+
+void Search_start(
+  Search *self, Window *target, const char *pattern, size_t pattern_length,
+  SearchRequest request, SearchDirection direction, size_t from_line, size_t nth
+) {
+  Search_cancel(self);
+  if (pattern_length > SEARCH_PATTERN_MAX) { pattern_length = SEARCH_PATTERN_MAX; }
+
+  // a new pattern makes the whole index stale
+  if (pattern_length != self->pattern_length || memcmp(pattern, self->pattern, pattern_length) != 0) {
+    memcpy(self->pattern, pattern, pattern_length);
+    self->pattern_length = pattern_length;
+    for (size_t i = 0; i < self->window_count; i += 1) {
+      self->windows[i].lines.item_count = 0;
+      self->windows[i].indexed_count = 0;
+    }
+    Search_free_regex(self);
+    self->error = NULL;
+    self->regex = Regex_compile(pattern, pattern_length, &self->error);
+  }
+
+  self->target = 0;
+  for (size_t i = 0; i < self->window_count; i += 1) {
+    if (self->windows[i].window == target) { self->target = i; }
+  }
+  self->request = request;
+  self->direction = direction;
+  self->from_line = from_line;
+  self->nth = (nth == 0) ? 1 : nth;
+  self->result_delivered = false;
+  atomic_store(&self->cancel, false);
+  atomic_store(&self->finished, false);
+  atomic_store(&self->lines_scanned, 0);
+  atomic_store(&self->result, SEARCH_PENDING);
+  if (self->regex == NULL) {
+    atomic_store(&self->result, SEARCH_NOT_FOUND);
+    return;
+  }
+
+  Search_plan_chunks(self);
+  // the answer may already be in the index
+  Search_resolve_locked(self);
+  if (self->chunk_count == 0) { return; }
+
+  if (pthread_create(&self->thread, NULL, Search_run, self) != 0) {
+    fprintf(stderr, "WARN: failed to start search thread\n");
+    Search_free_chunks(self);
+    atomic_store(&self->result, SEARCH_NOT_FOUND);
+    return;
+  }
+  self->running = true;
+}
+
+bool Search_is_waiting(Search *self) {
+  return self->running && atomic_load(&self->result) == SEARCH_PENDING;
+}
+
+int64_t Search_poll(Search *self) {
+  eventfd_t pending;
+  eventfd_read(self->wake_fd, &pending);
+  if (self->running && atomic_load(&self->finished)) {
+    pthread_join(self->thread, NULL);
+    self->running = false;
+  }
+  return atomic_load_explicit(&self->result, memory_order_acquire);
+}
+
+bool Search_is_complete(Search *self) {
+  if (self->running) { return false; }
+  for (size_t i = 0; i < self->window_count; i += 1) {
+    if (self->windows[i].window->hidden) { continue; }
+    if (self->windows[i].indexed_count < Window_line_count(self->windows[i].window)) { return false; }
+  }
+  return true;
+}
+
+size_t Search_window_match_count(Search *self, Window *window) {
+  for (size_t i = 0; i < self->window_count; i += 1) {
+    if (self->windows[i].window == window) { return self->windows[i].lines.item_count; }
+  }
+  return 0;
+}
+
+size_t Search_total_match_count(Search *self) {
+  size_t total = 0;
+  for (size_t i = 0; i < self->window_count; i += 1) { total += self->windows[i].lines.item_count; }
+  return total;
+}
+
+size_t Search_matches_through(Search *self, Window *window, size_t line) {
+  for (size_t i = 0; i < self->window_count; i += 1) {
+    if (self->windows[i].window == window) { return lower_bound(&self->windows[i].lines, line + 1); }
+  }
+  return 0;
+}
+
+void Search_cancel(Search *self) {
+  if (!self->running) { return; }
+  atomic_store(&self->cancel, true);
+  pthread_join(self->thread, NULL);
+  self->running = false;
+  if (atomic_load(&self->result) == SEARCH_PENDING) { atomic_store(&self->result, SEARCH_CANCELED); }
+  eventfd_t pending;
+  eventfd_read(self->wake_fd, &pending);
+}
+
+void Search_forget_window(Search *self, Window *window) {
+  Search_cancel(self);
+  for (size_t i = 0; i < self->window_count; i += 1) {
+    if (self->windows[i].window != window) { continue; }
+    self->windows[i].lines.item_count = 0;
+    self->windows[i].indexed_count = 0;
+  }
+}
+
+void Search_free(Search *self) {
+  Search_cancel(self);
+  for (size_t i = 0; i < self->window_count; i += 1) { List_size_t_free(&self->windows[i].lines); }
+  free(self->windows);
+  Search_free_regex(self);
+  free(self->matchers);
+  pthread_mutex_destroy(&self->resolve_mutex);
+  pthread_mutex_destroy(&self->matcher_mutex);
+  close(self->wake_fd);
+  free(self);
+}
@@ -0,0 +1,124 @@
+#include "stdint.h"
+#include "stddef.h"
+#include "stdbool.h"
+#include "stdatomic.h"
+#include "pthread.h"
+
+#include "interface.h"
+#include "pool.h"
+#include "regex.h"
+
+#ifndef SEARCH_H
+#define SEARCH_H
+
+#define SEARCH_PATTERN_MAX 256
+// the number of lines scanned by a single pool task
+#define SEARCH_CHUNK_LINES (16 * 1024)
+
+// values of Search.result that are not line numbers
+#define SEARCH_PENDING (-1)
+#define SEARCH_NOT_FOUND (-2)
+#define SEARCH_CANCELED (-3)
+
+declare_List(size_t)
+
+typedef enum {
+  SEARCH_FORWARD,
+  SEARCH_BACKWARD,
+} SearchDirection;
+
+typedef enum {
+  // the first match after (or before) from_line
+  SEARCH_REQUEST_NEXT,
+  // the nth match (counting from 1)
+  SEARCH_REQUEST_NTH,
+  // the number of matches in every window
+  SEARCH_REQUEST_COUNT,
+} SearchRequest;
+
+// the sorted line numbers of every match of the pattern in one window,
+// lines [0, indexed_count) have been searched
+typedef struct {
+  Window *window;
+  List_size_t lines;
+  size_t indexed_count;
+} WindowMatches;
+
+// a range of lines of one window scanned by a single pool task
+typedef struct {
+  size_t window;
+  size_t first_line, end_line;
+  List_size_t matches;
+  _Atomic bool done;
+} SearchChunk;
+
+// builds an index of the lines matching a regular expression (see regex.h)
+// across every window by
+// scanning chunks of lines on the pool, requests are answered from the index
+// and from chunks as they finish, so the UI keeps running (and can cancel) meanwhile
+//
+// the index is kept between requests for the same pattern and only lines
+// that arrived since the last request are scanned
+struct Search {
+  Pool *pool;
+  char pattern[SEARCH_PATTERN_MAX];
+  size_t pattern_length;
+  // the compiled pattern, or NULL with error set if it is invalid
+  Regex *regex;
+  const char *error;
+  // idle matchers for the pool tasks, each task takes one for its chunk
+  // so the DFA states they cache carry over between chunks
+  RegexMatcher **matchers;
+  size_t matcher_count, matcher_size;
+  pthread_mutex_t matcher_mutex;
+  WindowMatches *windows;
+  size_t window_count;
+
+  SearchRequest request;
+  size_t target;
+  SearchDirection direction;
+  size_t from_line;
+  size_t nth;
+  _Atomic int64_t result;
+  // set by the UI once it has acted on the result
+  bool result_delivered;
+
+  // the chunks of the job in flight, grouped by window in line order,
+  // and the order the pool should scan them in
+  SearchChunk *chunks;
+  size_t *chunk_order;
+  size_t chunk_count;
+  pthread_mutex_t resolve_mutex;
+
+  pthread_t thread;
+  bool running;
+  _Atomic bool finished;
+  _Atomic bool cancel;
+  _Atomic size_t lines_scanned;
+  // signalled when the result is known and when the job finishes
+  int wake_fd;
+};
+
+Search *Search_new(Pool *pool, Window *windows, size_t window_count);
+bool Search_line_matches(RegexMatcher *matcher, LineView line);
+// NOTE from_line is only used by SEARCH_REQUEST_NEXT and nth by SEARCH_REQUEST_NTH
+void Search_start(
+  Search *self, Window *target, const char *pattern, size_t pattern_length,
+  SearchRequest request, SearchDirection direction, size_t from_line, size_t nth
+);
+// true while the result of the last request is still unknown
+bool Search_is_waiting(Search *self);
+// clears wake_fd and joins the job if it finished, returns the result
+int64_t Search_poll(Search *self);
+// true if every line of every window (as of the last request) is indexed
+bool Search_is_complete(Search *self);
+size_t Search_window_match_count(Search *self, Window *window);
+size_t Search_total_match_count(Search *self);
+// the number of matches in window at or before line
+size_t Search_matches_through(Search *self, Window *window, size_t line);
+void Search_cancel(Search *self);
+// cancels the search and drops what was indexed of window, before its lines change
+void Search_forget_window(Search *self, Window *window);
+void Search_free(Search *self);
+
+#endif
@@ -0,0 +1,187 @@
+#include "stdint.h"
+#include "stddef.h"
+#include "stdlib.h"
+#include "string.h"
+#include "stdbool.h"
+
+#include "sgr.h"
+
+
+#define ESC 0x1b
+#define BEL 0x07
+// parameters past this many in one sequence are ignored
+#define SGR_MAX_PARAMS 32
+
+static void StyledText_push_span(StyledText *self, CellStyle style) {
+  if (self->span_count > 0) {
+    StyleSpan *last = &self->spans[self->span_count - 1];
+    if (last->style.flags == style.flags && last->style.fg == style.fg && last->style.bg == style.bg) { return; }
+    // NOTE a style that is replaced before any text uses it needs no span
+    if (last->offset == self->length) {
+      last->style = style;
+      return;
+    }
+  }
+  if (self->span_count == self->span_capacity) {
+    self->span_capacity = (self->span_capacity == 0) ? 8 : self->span_capacity * 2;
+    self->spans = realloc(self->spans, self->span_capacity * sizeof(StyleSpan));
+  }
+  self->spans[self->span_count] = (StyleSpan){ .offset = self->length, .style = style };
+  self->span_count += 1;
+}
+
+// the closest color of the 6x6x6 cube of the 256 color palette
+static uint8_t rgb_to_palette(uint32_t red, uint32_t green, uint32_t blue) {
+  uint32_t levels[3] = { red, green, blue };
+  uint32_t cube[3];
+  for (int i = 0; i < 3; i += 1) {
+    uint32_t level = (levels[i] > 255) ? 255 : levels[i];
+    cube[i] = (level < 48) ? 0 : (level < 115) ? 1 : (level - 35) / 40;
+  }
+  return 16 + cube[0] * 36 + cube[1] * 6 + cube[2];
+}
+
+// reads an extended color (5;n or 2;r;g;b) starting at params[*i], leaving
+// *i on its last parameter, returns false if it is incomplete
+static bool parse_extended_color(const uint32_t *params, size_t param_count, size_t *i, uint8_t *color) {
+  if (*i + 1 >= param_count) { return false; }
+  if (params[*i + 1] == 5 && *i + 2 < param_count) {
+    *color = params[*i + 2];
+    *i += 2;
+    return true;
+  }
+  if (params[*i + 1] == 2 && *i + 4 < param_count) {
+    *color = rgb_to_palette(params[*i + 2], params[*i + 3], params[*i + 4]);
+    *i += 4;
+    return true;
+  }
+  return false;
+}
+
+static void apply_sgr(CellStyle *style, const uint32_t *params, size_t param_count) {
+  // NOTE ESC [ m is the same as ESC [ 0 m
+  if (param_count == 0) { *style = STYLE_DEFAULT; }
+  for (size_t i = 0; i < param_count; i += 1) {
+    uint32_t param = params[i];
+    uint8_t color;
+    if (param == 0) { *style = STYLE_DEFAULT; }
+    else if (param == 1) { style->flags |= STYLE_BOLD; }
+    else if (param == 2) { style->flags |= STYLE_DIM; }
+    else if (param == 3) { style->flags |= STYLE_ITALIC; }
+    else if (param == 4) { style->flags |= STYLE_UNDERLINE; }
+    else if (param == 7) { style->flags |= STYLE_REVERSE; }
+    else if (param == 22) { style->flags &= ~(STYLE_BOLD | STYLE_DIM); }
+    else if (param == 23) { style->flags &= ~STYLE_ITALIC; }
+    else if (param == 24) { style->flags &= ~STYLE_UNDERLINE; }
+    else if (param == 27) { style->flags &= ~STYLE_REVERSE; }
+    else if (param >= 30 && param <= 37) { style->fg = param - 30; style->flags |= STYLE_FG_SET; }
+    else if (param >= 90 && param <= 97) { style->fg = param - 90 + 8; style->flags |= STYLE_FG_SET; }
+    else if (param == 39) { style->flags &= ~STYLE_FG_SET; }
+    else if (param >= 40 && param <= 47) { style->bg = param - 40; style->flags |= STYLE_BG_SET; }
+    else if (param >= 100 && param <= 107) { style->bg = param - 100 + 8; style->flags |= STYLE_BG_SET; }
+    else if (param == 49) { style->flags &= ~STYLE_BG_SET; }
+    else if (param == 38 || param == 48) {
+      if (!parse_extended_color(params, param_count, &i, &color)) { return; }
+      if (param == 38) { style->fg = color; style->flags |= STYLE_FG_SET; }
+      else { style->bg = color; style->flags |= STYLE_BG_SET; }
+    }
+    // blinking, strike through, fonts and the like are not shown
+  }
+}
+
+// returns the length of the escape sequence at line[0] (an ESC), applying
+// it to style if it is an SGR sequence, 0 if it runs past the end of the line
+static size_t parse_escape(const uint8_t *line, size_t length, CellStyle *style) {
+  if (length < 2) { return 0; }
+  size_t i = 2;
+  if (line[1] == '[') {
+    uint32_t params[SGR_MAX_PARAMS];
+    size_t param_count = 0;
+    uint32_t value = 0;
+    bool has_value = false;
+    // parameter bytes, then intermediate bytes, then the final byte
+    while (i < length && line[i] >= 0x30 && line[i] <= 0x3f) {
+      if (line[i] >= '0' && line[i] <= '9') {
+        value = (value > 100000) ? value : value * 10 + (line[i] - '0');
+        has_value = true;
+      }else if (line[i] == ';' || line[i] == ':') {
+        if (param_count < SGR_MAX_PARAMS) { params[param_count++] = value; }
+        value = 0;
+        has_value = true;
+      }else {
+        // a private sequence (ESC [ ? ...) is never SGR
+        has_value = false;
+        param_count = SGR_MAX_PARAMS + 1;
+      }
+      i += 1;
+    }
+    if (has_value && param_count < SGR_MAX_PARAMS) { params[param_count++] = value; }
+    while (i < length && line[i] >= 0x20 && line[i] <= 0x2f) { i += 1; }
+    if (i >= length) { return 0; }
+    if (line[i] == 'm' && param_count <= SGR_MAX_PARAMS) { apply_sgr(style, params, param_count); }
+    return i + 1;
+  }
+  if (line[1] == ']' || line[1] == 'P' || line[1] == '_' || line[1] == '^') {
+    // strings (OSC, DCS and the like) end with BEL or ESC backslash
+    while (i < length) {
+      if (line[i] == BEL) { return i + 1; }
+      if (line[i] == ESC && i + 1 < length && line[i + 1] == '\\') { return i + 2; }
+      i += 1;
+    }
+    return 0;
+  }
+  // the other sequences are ESC, intermediate bytes and a final byte
+  i = 1;
+  while (i < length && line[i] >= 0x20 && line[i] <= 0x2f) { i += 1; }
+  if (i >= length) { return 0; }
+  return i + 1;
+}
+
+bool sgr_parse(const char *line, size_t length, StyledText *styled) {
+  const char *escape = memchr(line, ESC, length);
+  if (escape == NULL) { return false; }
+
+  if (styled->capacity < length) {
+    styled->capacity = length;
+    styled->text = realloc(styled->text, length);
+  }
+  styled->length = 0;
+  styled->span_count = 0;
+  CellStyle style = STYLE_DEFAULT;
+  StyledText_push_span(styled, style);
+
+  const uint8_t *bytes = (const uint8_t *)line;
+  size_t i = 0;
+  while (escape != NULL) {
+    size_t text_length = (const char *)escape - (line + i);
+    memcpy(styled->text + styled->length, line + i, text_length);
+    styled->length += text_length;
+    i += text_length;
+
+    size_t escape_length = parse_escape(bytes + i, length - i, &style);
+    // NOTE a sequence cut off by the end of the line is dropped
+    if (escape_length == 0) { escape_length = length - i; }
+    i += escape_length;
+    StyledText_push_span(styled, style);
+    escape = memchr(line + i, ESC, length - i);
+  }
+  memcpy(styled->text + styled->length, line + i, length - i);
+  styled->length += length - i;
+  return true;
+}
+
+uint32_t StyledText_span_at(StyledText *self, size_t offset) {
+  uint32_t low = 0, high = self->span_count;
+  while (high - low > 1) {
+    uint32_t middle = low + (high - low) / 2;
+    if (self->spans[middle].offset <= offset) { low = middle; }
+    else { high = middle; }
+  }
+  return low;
+}
+
+void StyledText_free(StyledText *self) {
+  free(self->text);
+  free(self->spans);
+  *self = (StyledText){ 0 };
+}
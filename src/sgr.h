@@ -0,0 +1,36 @@
+#include "stdint.h"
+#include "stddef.h"
+#include "stdbool.h"
+
+#include "canvas.h"
+
+#ifndef SGR_H
+#define SGR_H
+
+// the style text has from offset up to the offset of the next span
+typedef struct {
+  uint32_t offset;
+  CellStyle style;
+} StyleSpan;
+
+// a line with its escape sequences taken out, the colors and attributes
+// its SGR sequences (ESC [ ... m) set are kept as spans instead
+typedef struct {
+  char *text;
+  size_t length, capacity;
+  // the first span is always at offset 0
+  StyleSpan *spans;
+  uint32_t span_count, span_capacity;
+} StyledText;
+
+// parses line into styled, reusing its buffers, other escape sequences
+// (cursor movement, OSC titles and hyperlinks) are dropped
+//
+// NOTE every line starts out in the default style, returns false and leaves
+// styled alone when the line has no escape sequences to take out
+bool sgr_parse(const char *line, size_t length, StyledText *styled);
+// the index of the span that the byte at offset is styled by
+uint32_t StyledText_span_at(StyledText *self, size_t offset);
+void StyledText_free(StyledText *self);
+
+#endif
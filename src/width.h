@@ -0,0 +1,33 @@
+#include "stdint.h"
+#include "stddef.h"
+
+#ifndef WIDTH_H
+#define WIDTH_H
+
+// tabs are expanded to the next multiple of this many columns
+#define TAB_WIDTH 8
+// what text_next gives for bytes that are not valid utf-8 and for the C1
+// control characters, which a terminal could take as the start of an escape
+#define CODEPOINT_INVALID UINT32_MAX
+
+// decodes the character at the start of text (available > 0 bytes) and
+// returns its length in bytes, setting codepoint and the columns it takes
+// on the terminal when it starts at display column column
+//
+// NOTE every caller lays out text with this, a tab goes to the next tab
+// stop, other control characters take 2 for their caret notation, combining
+// marks take 0, wide (east asian and emoji) characters 2 and invalid bytes 1
+size_t text_next(const char *text, size_t available, size_t column, uint32_t *codepoint, uint32_t *columns);
+// returns the byte offset of the first character of text that starts at
+// or after display column target, text starting at display column column,
+// the column that character starts at goes in reached (past target when
+// a wide character or tab straddles it), length if no character does
+size_t text_skip_columns(const char *text, size_t length, size_t column, size_t target, size_t *reached);
+// returns the length of the first row of text when it is wrapped at width
+// columns, a row takes at least one character and its tabs stop relative
+// to its start
+size_t text_wrap_row(const char *text, size_t length, size_t width);
+// the rows text takes when it is wrapped at width columns, 1 for no text
+size_t text_rows(const char *text, size_t length, size_t width);
+
+#endif